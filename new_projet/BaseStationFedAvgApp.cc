@@ -1,26 +1,683 @@
-//
-// This program is free software: you can redistribute it and/or modify
-// it under the terms of the GNU Lesser General Public License as published by
-// the Free Software Foundation, either version 3 of the License, or
-// (at your option) any later version.
-// 
-// This program is distributed in the hope that it will be useful,
-// but WITHOUT ANY WARRANTY; without even the implied warranty of
-// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-// GNU Lesser General Public License for more details.
-// 
-// You should have received a copy of the GNU Lesser General Public License
-// along with this program.  If not, see http://www.gnu.org/licenses/.
-// 
-
-#include "BaseStationFedAvgApp.h"
-
-BaseStationFedAvgApp::BaseStationFedAvgApp() {
-    // TODO Auto-generated constructor stub
-
-}
-
-BaseStationFedAvgApp::~BaseStationFedAvgApp() {
-    // TODO Auto-generated destructor stub
-}
-
+#include <algorithm>
+#include "BaseStationFedAvgApp.h"
+#include "inet/common/ModuleAccess.h"
+#include "inet/common/TimeTag_m.h"
+#include "inet/networklayer/common/L3AddressResolver.h"
+#include "inet/transportlayer/contract/udp/UdpControlInfo_m.h"
+#include "inet/networklayer/common/L3AddressTag_m.h"
+#include "inet/common/packet/chunk/cPacketChunk.h"
+
+Define_Module(BaseStationFedAvgApp);
+
+simsignal_t BaseStationFedAvgApp::rcvdPkSignal = registerSignal("rcvdPk");
+simsignal_t BaseStationFedAvgApp::aggregationCompletedSignal = registerSignal("aggregationCompleted");
+simsignal_t BaseStationFedAvgApp::globalLossSignal = registerSignal("globalLoss");
+simsignal_t BaseStationFedAvgApp::globalAccuracySignal = registerSignal("globalAccuracy");
+
+BaseStationFedAvgApp::BaseStationFedAvgApp() {
+}
+
+BaseStationFedAvgApp::~BaseStationFedAvgApp() {
+    cancelAndDelete(aggregationTimer);
+    cancelAndDelete(roundStartTimer);
+
+    // Clean up any stored model updates
+    for (auto& entry : receivedUpdates) {
+        delete entry.second;
+    }
+    receivedUpdates.clear();
+}
+
+void BaseStationFedAvgApp::initialize(int stage) {
+    ApplicationBase::initialize(stage);
+
+    if (stage == INITSTAGE_LOCAL) {
+        localPort = par("localPort");
+        clientPort = par("clientPort");
+        aggregationInterval = par("aggregationInterval");
+        roundInterval = par("roundInterval");
+        minUpdatesForAggregation = par("minUpdatesForAggregation");
+        totalClients = par("totalClients");
+        shardIndex = par("shardIndex");
+        numShards = par("numShards");
+        if (numShards < 1 || shardIndex < 0 || shardIndex >= numShards)
+            throw cRuntimeError("Invalid shard %d of %d", shardIndex, numShards);
+
+        try {
+            globalModel.configure(ModelArchitecture::parse(par("layerSizes").stdstringValue(),
+                    par("hiddenActivation").stdstringValue(), par("outputActivation").stdstringValue()));
+        }
+        catch (const std::invalid_argument& e) {
+            throw cRuntimeError("Invalid model description: %s", e.what());
+        }
+        if (par("scalarType").stdstringValue() != fedAvgScalarName())
+            throw cRuntimeError("Scenario requests %s weights but the model was built with %s (see makefrag)",
+                    par("scalarType").stringValue(), fedAvgScalarName());
+        try {
+            aggregator.configure(parseAggregationMode(par("aggregationMode").stdstringValue()),
+                    par("trimFraction").doubleValue(), par("clipNorm").doubleValue());
+        }
+        catch (const std::invalid_argument& e) {
+            throw cRuntimeError("Invalid aggregation settings: %s", e.what());
+        }
+
+        try {
+            serverOptimizer.configure(parseServerOptimizerType(par("serverOptimizer").stdstringValue()),
+                    par("serverLearningRate").doubleValue(), par("serverBeta1").doubleValue(),
+                    par("serverBeta2").doubleValue(), par("serverEpsilon").doubleValue());
+        }
+        catch (const std::invalid_argument& e) {
+            throw cRuntimeError("Invalid server optimizer settings: %s", e.what());
+        }
+
+        int evalSamples = par("evalSamples");
+        int evalBatchSize = par("evalBatchSize");
+        if (evalSamples <= 0 || evalBatchSize <= 0)
+            throw cRuntimeError("evalSamples and evalBatchSize must be positive");
+        // Shard 0 evaluates the full model, assembled from all shards' slices
+        if (isCoordinator())
+            evaluator.generate(globalModel.getArchitecture(), evalSamples, evalBatchSize, par("evalSeed").intValue());
+        globalModelVersion = 0;
+
+        shard = shardRange(globalModel.getNumParameters(), numShards, shardIndex);
+
+        EV_INFO << "Global model " << globalModel.getArchitecture().str() << " with "
+                << globalModel.getNumParameters() << " " << fedAvgScalarName() << " parameters" << endl;
+        if (numShards > 1)
+            EV_INFO << "Shard " << shardIndex << " of " << numShards << " owns parameters ["
+                    << shard.offset << ", " << shard.offset + shard.length << ")" << endl;
+
+        numReceived = 0;
+        numRoundsCompleted = 0;
+        numModelUpdatesReceived = 0;
+        WATCH(numReceived);
+        WATCH(numRoundsCompleted);
+        WATCH(numModelUpdatesReceived);
+        WATCH(numCorruptedUpdates);
+        WATCH(currentRound);
+    }
+    else if (stage == INITSTAGE_APPLICATION_LAYER) {
+        aggregationTimer = new cMessage("aggregationTimer");
+        roundStartTimer = new cMessage("roundStartTimer");
+
+        socket.setOutputGate(gate("socketOut"));
+        socket.bind(localPort);
+        socket.setCallback(this);
+
+        // Shard 0 coordinates the rounds of all shards
+        if (isCoordinator()) {
+            cStringTokenizer tokenizer(par("shardPeers"));
+            const char *token;
+            while ((token = tokenizer.nextToken()) != nullptr) {
+                L3Address peer;
+                if (!L3AddressResolver().tryResolve(token, peer))
+                    throw cRuntimeError("Cannot resolve shard peer address: %s", token);
+                shardPeers.push_back(peer);
+            }
+            if ((int)shardPeers.size() != numShards - 1)
+                throw cRuntimeError("Expected %d shard peers, got %d", numShards - 1, (int)shardPeers.size());
+
+            // Schedule the first training round to start
+            scheduleAt(simTime() + par("startTime"), roundStartTimer);
+        }
+    }
+}
+
+void BaseStationFedAvgApp::handleMessageWhenUp(cMessage *msg) {
+    if (msg->isSelfMessage()) {
+        if (msg == aggregationTimer) {
+            if (sliceAggregated) {
+                // A follower's slice got lost, repeat the aggregation order
+                sendShardControl(SHARD_AGGREGATE);
+                scheduleAt(simTime() + aggregationInterval/2, aggregationTimer);
+            }
+            else
+                aggregateModels();
+        }
+        else if (msg == roundStartTimer) {
+            startNewRound();
+        }
+    }
+    else
+        socket.processMessage(msg);
+}
+
+void BaseStationFedAvgApp::startNewRound() {
+    EV_INFO << "Starting new training round " << currentRound << endl;
+
+    // Reset for new round
+    roundInProgress = true;
+    preparingAggregation = false;
+    sliceAggregated = false;
+    aggregationSet.clear();
+    for (auto& entry : receivedUpdates) {
+        delete entry.second;
+    }
+    receivedUpdates.clear();
+
+    // Followers start the same round before the clients hear about it
+    if (isCoordinator())
+        sendShardControl(SHARD_START_ROUND);
+
+    // Tell clients to start training
+    broadcastInitiateTraining();
+
+    // Schedule aggregation after some time; followers wait for the coordinator
+    if (isCoordinator())
+        scheduleAt(simTime() + aggregationInterval, aggregationTimer);
+}
+
+void BaseStationFedAvgApp::sendShardControl(int command) {
+    // Proposals and aggregation orders carry the current aggregation set,
+    // the metrics message the evaluation of the assembled model
+    for (const auto& peer : shardPeers) {
+        FedAvgShardControl *control = new FedAvgShardControl();
+        control->setCommand(command);
+        if (command == SHARD_METRICS) {
+            const EvaluationResult& evaluation = evaluator.evaluate(globalModel, globalModelVersion);
+            control->setGlobalLoss(evaluation.loss);
+            control->setGlobalAccuracy(evaluation.accuracy);
+        }
+        else if (command != SHARD_START_ROUND) {
+            control->setUavIdsArraySize(aggregationSet.size());
+            for (size_t i = 0; i < aggregationSet.size(); i++)
+                control->setUavIds(i, aggregationSet[i]);
+        }
+        sendShardControl(control, peer);
+    }
+}
+
+void BaseStationFedAvgApp::sendShardControl(FedAvgShardControl *control, const L3Address& dest) {
+    static const char *packetNames[] = {"ShardStartRound", "ShardAggregate", "ShardPrepare", "ShardHave", "ShardMetrics"};
+
+    control->setRoundNumber(currentRound);
+    control->setShardIndex(shardIndex);
+    control->setByteLength(28 + 4 * control->getUavIdsArraySize());
+
+    Packet *packet = new Packet(packetNames[control->getCommand()]);
+    packet->addTag<CreationTimeTag>()->setCreationTime(simTime());
+    packet->insertAtBack(std::shared_ptr<cPacketChunk>(new cPacketChunk(control)));
+    socket.sendTo(packet, dest, localPort);
+}
+
+void BaseStationFedAvgApp::processShardControl(FedAvgShardControl *control, const L3Address& srcAddr) {
+    // Shard 0 only receives replies, the other shards only commands
+    if (isCoordinator() != (control->getCommand() == SHARD_HAVE)) {
+        EV_WARN << "Ignoring shard control message " << control->getCommand()
+                << " from shard " << control->getShardIndex() << endl;
+        return;
+    }
+
+    int round = control->getRoundNumber();
+
+    // A repeated aggregation order means shard 0 lost this shard's slice
+    if (control->getCommand() == SHARD_AGGREGATE && round == currentRound && sliceAggregated) {
+        sendShardSlice(srcAddr);
+        return;
+    }
+
+    // Metrics arrive after this shard aggregated, everything else before
+    bool inRound = round == currentRound
+            && (control->getCommand() == SHARD_METRICS ? sliceAggregated : roundInProgress);
+    if (control->getCommand() != SHARD_START_ROUND && !inRound) {
+        EV_WARN << "Ignoring shard control message " << control->getCommand() << " for round " << round
+                << ", current round is " << currentRound << endl;
+        return;
+    }
+
+    switch (control->getCommand()) {
+        case SHARD_START_ROUND:
+            EV_INFO << "Coordinator started round " << round << endl;
+            currentRound = round;
+            startNewRound();
+            break;
+        case SHARD_PREPARE: {
+            // Report which of the proposed updates this shard holds
+            FedAvgShardControl *reply = new FedAvgShardControl();
+            reply->setCommand(SHARD_HAVE);
+            for (size_t i = 0; i < control->getUavIdsArraySize(); i++) {
+                if (receivedUpdates.count(control->getUavIds(i)))
+                    reply->appendUavIds(control->getUavIds(i));
+            }
+            EV_INFO << "Holding " << reply->getUavIdsArraySize() << " of " << control->getUavIdsArraySize()
+                    << " proposed updates for round " << round << endl;
+            sendShardControl(reply, srcAddr);
+            break;
+        }
+        case SHARD_HAVE: {
+            if (!preparingAggregation)
+                break;
+
+            // Keep only the updates this peer holds as well
+            std::set<int> held;
+            for (size_t i = 0; i < control->getUavIdsArraySize(); i++)
+                held.insert(control->getUavIds(i));
+            aggregationSet.erase(std::remove_if(aggregationSet.begin(), aggregationSet.end(),
+                    [&held](int uavId) { return held.count(uavId) == 0; }), aggregationSet.end());
+            shardsReported.insert(control->getShardIndex());
+            if ((int)shardsReported.size() < numShards - 1)
+                break;
+
+            cancelEvent(aggregationTimer);
+            preparingAggregation = false;
+            if (aggregationSet.size() < minUpdatesForAggregation) {
+                EV_WARN << "Only " << aggregationSet.size() << " updates are held by every shard, need "
+                        << minUpdatesForAggregation << ". Extending aggregation time." << endl;
+                scheduleAt(simTime() + aggregationInterval/2, aggregationTimer);
+                break;
+            }
+
+            // Every shard holds the agreed updates; aggregate them everywhere
+            sendShardControl(SHARD_AGGREGATE);
+            aggregateSlice();
+            break;
+        }
+        case SHARD_AGGREGATE:
+            aggregationSet.clear();
+            for (size_t i = 0; i < control->getUavIdsArraySize(); i++)
+                aggregationSet.push_back(control->getUavIds(i));
+            aggregateSlice();
+
+            // Shard 0 evaluates the model assembled from all slices
+            sendShardSlice(srcAddr);
+            break;
+        case SHARD_METRICS:
+            publishGlobalModel(control->getGlobalLoss(), control->getGlobalAccuracy());
+            break;
+    }
+}
+
+void BaseStationFedAvgApp::broadcastInitiateTraining() {
+    // Create initiate training message
+    FedAvgInitiateTraining* initMsg = new FedAvgInitiateTraining();
+    initMsg->setRoundNumber(currentRound);
+    const FedAvgScalar *slice = globalModel.getWeights().data() + shard.offset;
+    initMsg->setWeights(slice, shard.length);
+    initMsg->setWeightsChecksum(computeChecksum(slice, shard.length));
+    initMsg->setShardIndex(shardIndex);
+    initMsg->setNumShards(numShards);
+    initMsg->setWeightsOffset(shard.offset);
+    initMsg->setByteLength(fedAvgMessageBytes(shard.length));
+
+    // Create packet
+    char msgName[32];
+    sprintf(msgName, "InitTraining-Round-%d", currentRound);
+    Packet *packet = new Packet(msgName);
+
+    // Add message as packet chunk
+    auto packetChunk = new cPacketChunk(initMsg);
+    packet->insertAtBack(std::shared_ptr<cPacketChunk>(packetChunk));
+
+    // Broadcast to all registered clients
+    if (clientAddresses.empty()) {
+        // If no clients registered yet, broadcast to network
+        socket.sendTo(packet, L3Address(), clientPort);
+        EV_INFO << "Broadcasting training initiation (round " << currentRound << ") to all potential clients" << endl;
+    } else {
+        // Send to each registered client
+        for (const auto& client : clientAddresses) {
+            socket.sendTo(packet->dup(), client.first, clientPort);
+        }
+        delete packet; // Delete original after dups sent
+        EV_INFO << "Sent training initiation to " << clientAddresses.size() << " registered clients" << endl;
+    }
+}
+
+void BaseStationFedAvgApp::aggregateModels() {
+    // Check if we have enough updates
+    if (receivedUpdates.size() < minUpdatesForAggregation) {
+        EV_WARN << "Not enough model updates received. Got " << receivedUpdates.size()
+                << ", need " << minUpdatesForAggregation << ". Extending aggregation time." << endl;
+
+        // Reschedule aggregation
+        scheduleAt(simTime() + aggregationInterval/2, aggregationTimer);
+        return;
+    }
+
+    aggregationSet.clear();
+    for (const auto& entry : receivedUpdates)
+        aggregationSet.push_back(entry.first);
+
+    // Shards receive the updates independently, so they first agree on
+    // the updates every one of them holds
+    if (numShards > 1)
+        proposeAggregationSet();
+    else
+        aggregateSlice();
+}
+
+void BaseStationFedAvgApp::proposeAggregationSet() {
+    EV_INFO << "Proposing " << aggregationSet.size() << " updates to the other shards" << endl;
+
+    preparingAggregation = true;
+    shardsReported.clear();
+    sendShardControl(SHARD_PREPARE);
+
+    // Propose again if a reply got lost
+    scheduleAt(simTime() + aggregationInterval/2, aggregationTimer);
+}
+
+void BaseStationFedAvgApp::aggregateSlice() {
+    EV_INFO << "Aggregating models for round " << currentRound << " using "
+            << par("aggregationMode").stringValue() << " with server optimizer "
+            << par("serverOptimizer").stringValue() << endl;
+
+    // Get total number of samples across the agreed clients; a follower
+    // has reported holding all of them
+    int totalSamples = 0;
+    std::vector<const FedAvgScalar*> clientWeights;
+    std::vector<double> clientSamples;
+    for (int uavId : aggregationSet) {
+        auto it = receivedUpdates.find(uavId);
+        if (it == receivedUpdates.end())
+            throw cRuntimeError("Shard %d has no update from UAV %d for round %d", shardIndex, uavId, currentRound);
+        totalSamples += it->second->getNumSamples();
+        clientWeights.push_back(it->second->getWeights().data());
+        clientSamples.push_back(it->second->getNumSamples());
+    }
+
+    if (totalSamples == 0 && aggregator.getMode() != AggregationMode::MEDIAN
+            && aggregator.getMode() != AggregationMode::TRIMMED_MEAN && !clientWeights.empty()) {
+        EV_ERROR << "Error: Total samples is 0, cannot perform weighted average" << endl;
+        return;
+    }
+
+    // Combine the flat weight slices (all updates were size-checked on
+    // arrival), then let the server optimizer step this shard's slice of
+    // the global model towards the aggregate
+    if (!clientWeights.empty()) {
+        FedAvgScalar *globalSlice = globalModel.getMutableWeights().data() + shard.offset;
+        aggregatedWeights.resize(shard.length);
+        aggregator.aggregate(clientWeights, clientSamples, globalSlice, aggregatedWeights.data(), shard.length);
+        serverOptimizer.step(globalSlice, aggregatedWeights.data(), shard.length);
+        globalModelVersion++;
+    }
+    else {
+        EV_WARN << "No model updates to aggregate, keeping the weights" << endl;
+    }
+
+    // No more updates for this round; it is published once evaluated
+    roundInProgress = false;
+    sliceAggregated = true;
+
+    // A shard only holds its slice of the model, so sharded runs evaluate
+    // on shard 0 once every follower has sent its slice back
+    if (numShards == 1)
+        publishEvaluatedModel();
+    else if (isCoordinator()) {
+        EV_INFO << "Shard 0 aggregation complete, waiting for the other slices. Round: " << currentRound << endl;
+        shardsReported.clear();
+        scheduleAt(simTime() + aggregationInterval/2, aggregationTimer);
+    }
+    else
+        EV_INFO << "Shard " << shardIndex << " aggregation complete. Round: " << currentRound << endl;
+}
+
+void BaseStationFedAvgApp::publishEvaluatedModel() {
+    // Evaluate the new global model on the held-out set (cached, so the
+    // metrics sent to the other shards cost no second pass)
+    const EvaluationResult& evaluation = evaluator.evaluate(globalModel, globalModelVersion);
+    double globalAccuracy = evaluation.accuracy;
+    double globalLoss = evaluation.loss;
+
+    // Emit statistics
+    emit(globalAccuracySignal, globalAccuracy);
+    emit(globalLossSignal, globalLoss);
+
+    EV_INFO << "Model aggregation complete. Round: " << currentRound
+            << ", Global Accuracy: " << globalAccuracy
+            << ", Global Loss: " << globalLoss << endl;
+
+    if (numShards > 1)
+        sendShardControl(SHARD_METRICS);
+    publishGlobalModel(globalLoss, globalAccuracy);
+}
+
+void BaseStationFedAvgApp::publishGlobalModel(double globalLoss, double globalAccuracy) {
+    emit(aggregationCompletedSignal, currentRound);
+
+    // Broadcast the new global model
+    broadcastGlobalModel(globalLoss, globalAccuracy);
+
+    // Complete the round
+    numRoundsCompleted++;
+    sliceAggregated = false;
+
+    // Schedule next round
+    currentRound++;
+    if (isCoordinator())
+        scheduleAt(simTime() + roundInterval, roundStartTimer);
+}
+
+void BaseStationFedAvgApp::sendShardSlice(const L3Address& dest) {
+    FedAvgGlobalModel* sliceMsg = new FedAvgGlobalModel();
+    sliceMsg->setRoundNumber(currentRound);
+    const FedAvgScalar *slice = globalModel.getWeights().data() + shard.offset;
+    sliceMsg->setWeights(slice, shard.length);
+    sliceMsg->setWeightsChecksum(computeChecksum(slice, shard.length));
+    sliceMsg->setShardIndex(shardIndex);
+    sliceMsg->setNumShards(numShards);
+    sliceMsg->setWeightsOffset(shard.offset);
+    sliceMsg->setByteLength(fedAvgMessageBytes(shard.length));
+
+    Packet *packet = new Packet("ShardSlice");
+    packet->addTag<CreationTimeTag>()->setCreationTime(simTime());
+    packet->insertAtBack(std::shared_ptr<cPacketChunk>(new cPacketChunk(sliceMsg)));
+    socket.sendTo(packet, dest, localPort);
+}
+
+void BaseStationFedAvgApp::processShardSlice(FedAvgGlobalModel *slice) {
+    int peer = slice->getShardIndex();
+    if (!isCoordinator() || !sliceAggregated || slice->getRoundNumber() != currentRound) {
+        EV_WARN << "Ignoring slice of shard " << peer << " for round " << slice->getRoundNumber()
+                << ", current round is " << currentRound << endl;
+        return;
+    }
+    if (shardsReported.count(peer))
+        return; // repeated after a lost slice
+
+    // Reject slices that do not match the layout or arrived corrupted
+    const auto& weights = slice->getWeights();
+    bool known = peer > 0 && peer < numShards && slice->getNumShards() == numShards;
+    ShardRange range = known ? shardRange(globalModel.getNumParameters(), numShards, peer) : ShardRange{0, 0};
+    if (!known || slice->getWeightsOffset() != range.offset || weights.size() != range.length
+            || computeChecksum(weights.data(), weights.size()) != slice->getWeightsChecksum()) {
+        EV_WARN << "Discarding invalid slice of shard " << peer << endl;
+        return;
+    }
+
+    std::copy(weights.begin(), weights.end(), globalModel.getMutableWeights().begin() + range.offset);
+    globalModelVersion++;
+    shardsReported.insert(peer);
+    if ((int)shardsReported.size() < numShards - 1)
+        return;
+
+    // The full model is assembled
+    cancelEvent(aggregationTimer);
+    publishEvaluatedModel();
+}
+
+void BaseStationFedAvgApp::broadcastGlobalModel(double globalLoss, double globalAccuracy) {
+    // Create global model message
+    FedAvgGlobalModel* globalModelMsg = new FedAvgGlobalModel();
+    globalModelMsg->setRoundNumber(currentRound);
+    const FedAvgScalar *slice = globalModel.getWeights().data() + shard.offset;
+    globalModelMsg->setWeights(slice, shard.length);
+    globalModelMsg->setWeightsChecksum(computeChecksum(slice, shard.length));
+    globalModelMsg->setShardIndex(shardIndex);
+    globalModelMsg->setNumShards(numShards);
+    globalModelMsg->setWeightsOffset(shard.offset);
+    globalModelMsg->setByteLength(fedAvgMessageBytes(shard.length));
+
+    // Metrics of the full model, evaluated once per version by shard 0
+    globalModelMsg->setGlobalAccuracy(globalAccuracy);
+    globalModelMsg->setGlobalLoss(globalLoss);
+
+    // Create packet
+    char msgName[32];
+    sprintf(msgName, "GlobalModel-Round-%d", currentRound);
+    Packet *packet = new Packet(msgName);
+
+    // Add message as packet chunk
+    auto packetChunk = new cPacketChunk(globalModelMsg);
+    packet->insertAtBack(std::shared_ptr<cPacketChunk>(packetChunk));
+
+    // Broadcast to all registered clients
+    if (clientAddresses.empty()) {
+        // If no clients registered yet, broadcast to network
+        socket.sendTo(packet, L3Address(), clientPort);
+        EV_INFO << "Broadcasting global model (round " << currentRound << ") to all potential clients" << endl;
+    } else {
+        // Send to each registered client
+        for (const auto& client : clientAddresses) {
+            socket.sendTo(packet->dup(), client.first, clientPort);
+        }
+        delete packet; // Delete original after dups sent
+        EV_INFO << "Sent global model to " << clientAddresses.size() << " clients" << endl;
+    }
+}
+
+void BaseStationFedAvgApp::socketDataArrived(UdpSocket *socket, Packet *packet) {
+    // Process incoming packets from UAVs
+    auto addressInd = packet->getTag<L3AddressInd>();
+    L3Address srcAddr = addressInd->getSrcAddress();
+
+    // Calculate end-to-end delay (the tag may be missing on packets
+    // from other partitions of a parallel simulation)
+    auto creationTimeTag = packet->findTag<CreationTimeTag>();
+    if (creationTimeTag != nullptr) {
+        simtime_t delay = simTime() - creationTimeTag->getCreationTime();
+        EV_INFO << "Received packet " << packet->getName() << " from UAV at "
+                << srcAddr.str() << ". Delay: " << delay << "s" << endl;
+    }
+    else
+        EV_INFO << "Received packet " << packet->getName() << " from UAV at " << srcAddr.str() << endl;
+
+    // Update statistics
+    numReceived++;
+    emit(rcvdPkSignal, packet);
+
+    // Check if it's a model update
+    cPacketChunk *chunk = dynamic_cast<cPacketChunk *>(packet->peekAtFront().get());
+    if (chunk) {
+        cPacket *innerPacket = chunk->getPacket();
+
+        if (FedAvgModelUpdate *modelUpdate = dynamic_cast<FedAvgModelUpdate *>(innerPacket)) {
+            // Register client if not already registered
+            if (clientAddresses.find(srcAddr) == clientAddresses.end()) {
+                clientAddresses[srcAddr] = modelUpdate->getUavId();
+                EV_INFO << "Registered new client: " << srcAddr.str() << " with ID " << modelUpdate->getUavId() << endl;
+            }
+
+            // Process the model update; it stores its own copy
+            processModelUpdate(modelUpdate, srcAddr);
+            delete packet;
+            return;
+        }
+        else if (FedAvgShardControl *control = dynamic_cast<FedAvgShardControl *>(innerPacket)) {
+            processShardControl(control, srcAddr);
+        }
+        else if (FedAvgGlobalModel *slice = dynamic_cast<FedAvgGlobalModel *>(innerPacket)) {
+            processShardSlice(slice);
+        }
+    }
+
+    delete packet;
+}
+
+void BaseStationFedAvgApp::processModelUpdate(FedAvgModelUpdate* update, L3Address senderAddr) {
+    int clientId = update->getUavId();
+
+    EV_INFO << "Processing model update from UAV ID " << clientId
+            << " for round " << update->getRoundNumber()
+            << " with " << update->getNumSamples() << " samples" << endl;
+
+    // Reject updates that do not match the global model or arrived corrupted
+    const auto& weights = update->getWeights();
+    if (update->getShardIndex() != shardIndex || update->getNumShards() != numShards
+            || update->getWeightsOffset() != shard.offset || weights.size() != shard.length) {
+        EV_WARN << "Discarding model update with " << weights.size() << " parameters at offset "
+                << update->getWeightsOffset() << ", expected " << shard.length << " at offset "
+                << shard.offset << endl;
+        numCorruptedUpdates++;
+        return;
+    }
+    if (computeChecksum(weights.data(), weights.size()) != update->getWeightsChecksum()) {
+        EV_WARN << "Discarding model update from UAV ID " << clientId << ": checksum mismatch" << endl;
+        numCorruptedUpdates++;
+        return;
+    }
+
+    // Only process if it's for the current round
+    if (update->getRoundNumber() == currentRound && roundInProgress) {
+        // Store the update (replacing any previous update from this client)
+        if (receivedUpdates.find(clientId) != receivedUpdates.end()) {
+            delete receivedUpdates[clientId]; // Delete old update
+        }
+
+        receivedUpdates[clientId] = update->dup(); // Store a copy
+        numModelUpdatesReceived++;
+
+        EV_INFO << "Stored model update. Now have " << receivedUpdates.size()
+                << " updates for round " << currentRound << endl;
+
+        // If we have received updates from all clients, we can aggregate early
+        if (isCoordinator() && !preparingAggregation && receivedUpdates.size() >= totalClients) {
+            EV_INFO << "Received updates from all clients. Aggregating early." << endl;
+            cancelEvent(aggregationTimer);
+            scheduleAt(simTime() + 0.1, aggregationTimer); // Aggregate soon
+        }
+    } else {
+        EV_WARN << "Received model update for wrong round. Current round: "
+                << currentRound << ", update round: " << update->getRoundNumber() << endl;
+    }
+}
+
+void BaseStationFedAvgApp::socketErrorArrived(UdpSocket *socket, Indication *indication) {
+    EV_WARN << "Socket error: " << indication->getName() << endl;
+    delete indication;
+}
+
+void BaseStationFedAvgApp::socketClosed(UdpSocket *socket) {
+    if (operationalState == State::STOPPING_OPERATION) {
+        startActiveOperationExtraTimeOrFinish(par("stopOperationExtraTime"));
+    }
+}
+
+void BaseStationFedAvgApp::handleStartOperation(LifecycleOperation *operation) {
+    socket.setOutputGate(gate("socketOut"));
+    socket.bind(localPort);
+    socket.setCallback(this);
+
+    // Start federated learning process
+    if (isCoordinator())
+        scheduleAt(simTime() + par("startTime"), roundStartTimer);
+}
+
+void BaseStationFedAvgApp::handleStopOperation(LifecycleOperation *operation) {
+    cancelEvent(aggregationTimer);
+    cancelEvent(roundStartTimer);
+    socket.close();
+    delayActiveOperationFinish(par("stopOperationTimeout"));
+}
+
+void BaseStationFedAvgApp::handleCrashOperation(LifecycleOperation *operation) {
+    cancelEvent(aggregationTimer);
+    cancelEvent(roundStartTimer);
+    socket.destroy();
+}
+
+void BaseStationFedAvgApp::finish() {
+    ApplicationBase::finish();
+
+    EV_INFO << "Base Station FedAvg Application finished." << endl;
+    EV_INFO << "Received: " << numReceived << " packets in total." << endl;
+    EV_INFO << "Completed " << numRoundsCompleted << " federated learning rounds." << endl;
+    EV_INFO << "Received " << numModelUpdatesReceived << " model updates from clients." << endl;
+    EV_INFO << "Discarded " << numCorruptedUpdates << " corrupted or mismatched model updates." << endl;
+
+    EV_INFO << "Registered clients:" << endl;
+    for (auto& pair : clientAddresses) {
+        EV_INFO << "  UAV at " << pair.first.str() << " with ID " << pair.second << endl;
+    }
+}
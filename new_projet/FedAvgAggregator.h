@@ -0,0 +1,210 @@
+#ifndef __FEDAVGAGGREGATOR_H
+#define __FEDAVGAGGREGATOR_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include "FedAvgModel.h"
+
+// How client updates are combined into the global model
+enum class AggregationMode {
+    MEAN,           // Sample-weighted mean (plain FedAvg)
+    MEDIAN,         // Coordinate-wise median
+    TRIMMED_MEAN,   // Coordinate-wise mean after dropping the extremes
+    CLIPPED_MEAN    // Sample-weighted mean of norm-clipped deltas
+};
+
+inline AggregationMode parseAggregationMode(const std::string& name) {
+    if (name == "mean") return AggregationMode::MEAN;
+    if (name == "median") return AggregationMode::MEDIAN;
+    if (name == "trimmedMean") return AggregationMode::TRIMMED_MEAN;
+    if (name == "clippedMean") return AggregationMode::CLIPPED_MEAN;
+    throw std::invalid_argument("Unknown aggregation mode: " + name);
+}
+
+// Combines the flat weight arenas of N clients into one arena of d
+// parameters. The robust modes work on blocks of coordinates: a block is
+// transposed into a contiguous coordinate-major scratch buffer and each
+// coordinate is reduced with nth_element selection, so the cost stays
+// O(N*d) on average instead of the O(N*log(N)*d) of per-coordinate sorts.
+template<typename Scalar>
+class FedAvgAggregator {
+  private:
+    static constexpr size_t blockSize = 64;
+
+    AggregationMode mode = AggregationMode::MEAN;
+    double trimFraction = 0.1;
+    double clipNorm = 0;
+
+    std::vector<Scalar> block;                 // blockSize x N, coordinate-major
+    std::vector<FedAvgAccumulator> accumulator;
+    std::vector<FedAvgAccumulator> scales;
+
+  public:
+    FedAvgAggregator() {}
+
+    void configure(AggregationMode mode, double trimFraction, double clipNorm) {
+        if (trimFraction < 0 || trimFraction >= 0.5) {
+            throw std::invalid_argument("Trim fraction must be in [0, 0.5)");
+        }
+        if (clipNorm < 0) {
+            throw std::invalid_argument("Clip norm must not be negative");
+        }
+        this->mode = mode;
+        this->trimFraction = trimFraction;
+        this->clipNorm = clipNorm;
+    }
+
+    AggregationMode getMode() const { return mode; }
+
+    // clients[i] points at the d weights of client i and numSamples[i] is
+    // its sample count. reference holds the current global weights (used
+    // by CLIPPED_MEAN) and may alias out.
+    void aggregate(const std::vector<const Scalar*>& clients, const std::vector<double>& numSamples,
+                   const Scalar* reference, Scalar* out, size_t d) {
+        if (clients.empty() || clients.size() != numSamples.size()) {
+            throw std::invalid_argument("No client updates to aggregate");
+        }
+        switch (mode) {
+            case AggregationMode::MEAN: weightedMean(clients, numSamples, out, d); break;
+            case AggregationMode::MEDIAN: coordinateMedian(clients, out, d); break;
+            case AggregationMode::TRIMMED_MEAN: trimmedMean(clients, out, d); break;
+            case AggregationMode::CLIPPED_MEAN: clippedMean(clients, numSamples, reference, out, d); break;
+        }
+    }
+
+  protected:
+    void weightedMean(const std::vector<const Scalar*>& clients, const std::vector<double>& numSamples,
+                      Scalar* out, size_t d) {
+        double totalSamples = std::accumulate(numSamples.begin(), numSamples.end(), 0.0);
+        if (totalSamples <= 0) {
+            throw std::invalid_argument("Total samples is 0, cannot perform weighted average");
+        }
+
+        accumulator.assign(d, FedAvgAccumulator(0));
+        for (size_t c = 0; c < clients.size(); c++) {
+            const Scalar* weights = clients[c];
+            FedAvgAccumulator weight = numSamples[c] / totalSamples;
+            for (size_t i = 0; i < d; i++) {
+                accumulator[i] += weights[i] * weight;
+            }
+        }
+        store(out, d);
+    }
+
+    // Copy coordinates [begin, begin+count) of every client into the
+    // scratch buffer so that each coordinate's N values are contiguous
+    void gatherBlock(const std::vector<const Scalar*>& clients, size_t begin, size_t count) {
+        size_t n = clients.size();
+        block.resize(blockSize * n);
+        for (size_t c = 0; c < n; c++) {
+            const Scalar* src = clients[c] + begin;
+            for (size_t j = 0; j < count; j++) {
+                block[j * n + c] = src[j];
+            }
+        }
+    }
+
+    void coordinateMedian(const std::vector<const Scalar*>& clients, Scalar* out, size_t d) {
+        size_t n = clients.size();
+        size_t mid = n / 2;
+        for (size_t begin = 0; begin < d; begin += blockSize) {
+            size_t count = std::min(blockSize, d - begin);
+            gatherBlock(clients, begin, count);
+            for (size_t j = 0; j < count; j++) {
+                Scalar* row = block.data() + j * n;
+                std::nth_element(row, row + mid, row + n);
+                FedAvgAccumulator median = row[mid];
+                if (n % 2 == 0) {
+                    // Lower middle value is the largest of the lower half
+                    median = (median + *std::max_element(row, row + mid)) / 2;
+                }
+                out[begin + j] = static_cast<Scalar>(median);
+            }
+        }
+    }
+
+    void trimmedMean(const std::vector<const Scalar*>& clients, Scalar* out, size_t d) {
+        size_t n = clients.size();
+        // Round up so a small client set still drops at least one value
+        // at each end instead of degrading to a plain mean
+        size_t trim = static_cast<size_t>(std::ceil(trimFraction * n - 1e-9));
+        if (2 * trim >= n) {
+            trim = (n - 1) / 2;
+        }
+        size_t kept = n - 2 * trim;
+        for (size_t begin = 0; begin < d; begin += blockSize) {
+            size_t count = std::min(blockSize, d - begin);
+            gatherBlock(clients, begin, count);
+            for (size_t j = 0; j < count; j++) {
+                Scalar* row = block.data() + j * n;
+                if (trim > 0) {
+                    // Move the trim smallest values to the front, then the
+                    // trim largest of the remainder to the back
+                    std::nth_element(row, row + trim, row + n);
+                    std::nth_element(row + trim, row + n - trim, row + n);
+                }
+                FedAvgAccumulator sum = 0;
+                for (size_t k = trim; k < n - trim; k++) {
+                    sum += row[k];
+                }
+                out[begin + j] = static_cast<Scalar>(sum / kept);
+            }
+        }
+    }
+
+    void clippedMean(const std::vector<const Scalar*>& clients, const std::vector<double>& numSamples,
+                     const Scalar* reference, Scalar* out, size_t d) {
+        size_t n = clients.size();
+        double totalSamples = std::accumulate(numSamples.begin(), numSamples.end(), 0.0);
+        if (totalSamples <= 0) {
+            throw std::invalid_argument("Total samples is 0, cannot perform weighted average");
+        }
+
+        // L2 norm of each client's delta from the current global model
+        std::vector<double> norms(n);
+        for (size_t c = 0; c < n; c++) {
+            FedAvgAccumulator sq = 0;
+            for (size_t i = 0; i < d; i++) {
+                FedAvgAccumulator delta = FedAvgAccumulator(clients[c][i]) - reference[i];
+                sq += delta * delta;
+            }
+            norms[c] = std::sqrt(sq);
+        }
+
+        // Without a configured bound, clip to the median delta norm
+        double threshold = clipNorm;
+        if (threshold <= 0) {
+            std::vector<double> sorted(norms);
+            std::nth_element(sorted.begin(), sorted.begin() + n / 2, sorted.end());
+            threshold = sorted[n / 2];
+        }
+
+        scales.resize(n);
+        for (size_t c = 0; c < n; c++) {
+            double clip = (norms[c] > threshold && norms[c] > 0) ? threshold / norms[c] : 1.0;
+            scales[c] = clip * numSamples[c] / totalSamples;
+        }
+
+        accumulator.assign(reference, reference + d);
+        for (size_t c = 0; c < n; c++) {
+            const Scalar* weights = clients[c];
+            FedAvgAccumulator scale = scales[c];
+            for (size_t i = 0; i < d; i++) {
+                accumulator[i] += (FedAvgAccumulator(weights[i]) - reference[i]) * scale;
+            }
+        }
+        store(out, d);
+    }
+
+    void store(Scalar* out, size_t d) const {
+        for (size_t i = 0; i < d; i++) {
+            out[i] = static_cast<Scalar>(accumulator[i]);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef __FEDAVGEVALUATOR_H
+#define __FEDAVGEVALUATOR_H
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include "FedAvgModel.h"
+
+// Loss and accuracy of a model on the held-out set
+struct EvaluationResult {
+    double loss = 0;
+    double accuracy = 0;
+    size_t numSamples = 0;
+};
+
+// Labels feature rows with a seeded teacher model of the given
+// architecture. The base station's held-out set and the UAVs' local
+// samples use the same seed, so local training optimizes the task the
+// global model is scored on.
+template<typename Scalar>
+class FedAvgTeacher {
+  private:
+    FedAvgModelT<Scalar> model;
+
+  public:
+    void configure(const ModelArchitecture& arch, unsigned int seed) {
+        model.seed(seed + 1);
+        model.configure(arch);
+    }
+
+    template<typename Input>
+    int label(const Input& features) const {
+        std::vector<Scalar> outputs = model.predict(features);
+        return predictedClass(outputs.data(), static_cast<int>(outputs.size()));
+    }
+
+    void labelBatch(const Scalar* features, size_t count, std::vector<int>& labels) const {
+        std::vector<Scalar> outputs, scratch;
+        model.predictBatch(features, count, outputs, scratch);
+        int numOutputs = model.getArchitecture().outputSize();
+        labels.resize(count);
+        for (size_t r = 0; r < count; r++) {
+            labels[r] = predictedClass(outputs.data() + r * numOutputs, numOutputs);
+        }
+    }
+};
+
+// Scores a model on a cached held-out dataset. The dataset is generated
+// once: features are drawn like the UAV sensor samples and labelled by the
+// seeded FedAvgTeacher the UAVs also use. Features are stored
+// contiguously (row-major) and scored in batches with
+// FedAvgModelT::predictBatch. Results are cached per model version, so
+// scoring the same global model twice costs nothing.
+template<typename Scalar>
+class FedAvgEvaluator {
+  private:
+    int inputSize = 0;
+    int numClasses = 0;
+    size_t batchSize = 256;
+    ParameterArenaT<Scalar> features;   // numSamples x inputSize
+    std::vector<int> labels;
+
+    std::vector<Scalar> outputs;
+    std::vector<Scalar> scratch;
+
+    uint64_t cachedVersion = std::numeric_limits<uint64_t>::max();
+    EvaluationResult cachedResult;
+
+  public:
+    FedAvgEvaluator() {}
+
+    void generate(const ModelArchitecture& arch, size_t numSamples, size_t batchSize, unsigned int seed) {
+        if (numSamples == 0 || batchSize == 0) {
+            throw std::invalid_argument("Held-out set and batch size must not be empty");
+        }
+        this->inputSize = arch.inputSize();
+        this->numClasses = arch.outputSize();
+        this->batchSize = batchSize;
+
+        std::mt19937 rng(seed);
+        std::normal_distribution<Scalar> dist(0, 1);
+        features.resize(numSamples * inputSize);
+        for (auto& value : features) {
+            value = dist(rng);
+        }
+
+        FedAvgTeacher<Scalar> teacher;
+        teacher.configure(arch, seed);
+        teacher.labelBatch(features.data(), numSamples, labels);
+
+        invalidate();
+    }
+
+    size_t getNumSamples() const { return labels.size(); }
+
+    void invalidate() {
+        cachedVersion = std::numeric_limits<uint64_t>::max();
+    }
+
+    // Score the model; version identifies the weights the model holds
+    const EvaluationResult& evaluate(const FedAvgModelT<Scalar>& model, uint64_t version) {
+        if (version == cachedVersion) {
+            return cachedResult;
+        }
+        if (model.getArchitecture().inputSize() != inputSize || model.getArchitecture().outputSize() != numClasses) {
+            throw std::invalid_argument("Model does not match the held-out set");
+        }
+
+        size_t n = labels.size();
+        double totalLoss = 0;
+        size_t correct = 0;
+        for (size_t begin = 0; begin < n; begin += batchSize) {
+            size_t count = std::min(batchSize, n - begin);
+            model.predictBatch(features.data() + begin * inputSize, count, outputs, scratch);
+            for (size_t r = 0; r < count; r++) {
+                const Scalar* logits = outputs.data() + r * numClasses;
+                int label = labels[begin + r];
+                totalLoss += crossEntropyLoss(logits, numClasses, label);
+                if (predictedClass(logits, numClasses) == label) {
+                    correct++;
+                }
+            }
+        }
+
+        cachedResult.loss = totalLoss / n;
+        cachedResult.accuracy = static_cast<double>(correct) / n;
+        cachedResult.numSamples = n;
+        cachedVersion = version;
+        return cachedResult;
+    }
+};
+
+#endif
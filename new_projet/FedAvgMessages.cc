@@ -0,0 +1,12 @@
+#include "FedAvgMessages.h"
+
+namespace inet {
+
+// The generated _Base classes are abstract; register the concrete
+// subclasses so they can be created by name, e.g. when unpacked in
+// another partition of a parallel simulation
+Register_Class(FedAvgModelUpdate);
+Register_Class(FedAvgInitiateTraining);
+Register_Class(FedAvgGlobalModel);
+
+} // namespace inet
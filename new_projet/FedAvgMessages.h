@@ -0,0 +1,82 @@
+#ifndef __FEDAVGMESSAGES_H
+#define __FEDAVGMESSAGES_H
+
+#include "FedAvgMessages_m.h"
+
+namespace inet {
+
+// Weight storage shared by the FedAvg messages. The flat weight arena is
+// copied by dup() and packed as one array for parallel simulation, so the
+// messages can cross partition boundaries.
+template<typename Base>
+class FedAvgWeightsMessage : public Base {
+  public:
+    typedef ParameterArena WeightsVector;
+
+  protected:
+    WeightsVector weights_var;
+
+  public:
+    FedAvgWeightsMessage(const char *name, short kind) : Base(name, kind) {}
+    FedAvgWeightsMessage(const FedAvgWeightsMessage& other) : Base(other), weights_var(other.weights_var) {}
+    FedAvgWeightsMessage& operator=(const FedAvgWeightsMessage& other) {
+        if (this == &other) return *this;
+        Base::operator=(other);
+        weights_var = other.weights_var;
+        return *this;
+    }
+
+    // Getters for std::vector field
+    const WeightsVector& getWeights() const { return weights_var; }
+    virtual double getWeights(size_t k) const override { return weights_var.at(k); }
+    void setWeights(const WeightsVector& weights) { weights_var = weights; }
+    void setWeights(const FedAvgScalar* weights, size_t count) { weights_var.assign(weights, weights + count); }
+    virtual void setWeights(size_t k, double weight) override { weights_var.at(k) = weight; }
+    virtual size_t getWeightsArraySize() const override { return weights_var.size(); }
+    virtual void setWeightsArraySize(size_t size) override { weights_var.resize(size); }
+    virtual void insertWeights(size_t k, double weight) override { weights_var.insert(weights_var.begin() + k, weight); }
+    virtual void appendWeights(double weight) override { weights_var.push_back(weight); }
+    virtual void eraseWeights(size_t k) override { weights_var.erase(weights_var.begin() + k); }
+
+    virtual void parsimPack(omnetpp::cCommBuffer *b) const override {
+        Base::parsimPack(b);
+        b->pack(static_cast<unsigned int>(weights_var.size()));
+        b->pack(weights_var.data(), static_cast<int>(weights_var.size()));
+    }
+
+    virtual void parsimUnpack(omnetpp::cCommBuffer *b) override {
+        Base::parsimUnpack(b);
+        unsigned int size;
+        b->unpack(size);
+        weights_var.resize(size);
+        b->unpack(weights_var.data(), static_cast<int>(size));
+    }
+};
+
+class FedAvgModelUpdate : public FedAvgWeightsMessage<FedAvgModelUpdate_Base> {
+  public:
+    FedAvgModelUpdate(const char *name = nullptr, short kind = 0) : FedAvgWeightsMessage(name, kind) {}
+    FedAvgModelUpdate(const FedAvgModelUpdate& other) : FedAvgWeightsMessage(other) {}
+    FedAvgModelUpdate& operator=(const FedAvgModelUpdate& other) { FedAvgWeightsMessage::operator=(other); return *this; }
+    virtual FedAvgModelUpdate *dup() const override { return new FedAvgModelUpdate(*this); }
+};
+
+class FedAvgInitiateTraining : public FedAvgWeightsMessage<FedAvgInitiateTraining_Base> {
+  public:
+    FedAvgInitiateTraining(const char *name = nullptr, short kind = 0) : FedAvgWeightsMessage(name, kind) {}
+    FedAvgInitiateTraining(const FedAvgInitiateTraining& other) : FedAvgWeightsMessage(other) {}
+    FedAvgInitiateTraining& operator=(const FedAvgInitiateTraining& other) { FedAvgWeightsMessage::operator=(other); return *this; }
+    virtual FedAvgInitiateTraining *dup() const override { return new FedAvgInitiateTraining(*this); }
+};
+
+class FedAvgGlobalModel : public FedAvgWeightsMessage<FedAvgGlobalModel_Base> {
+  public:
+    FedAvgGlobalModel(const char *name = nullptr, short kind = 0) : FedAvgWeightsMessage(name, kind) {}
+    FedAvgGlobalModel(const FedAvgGlobalModel& other) : FedAvgWeightsMessage(other) {}
+    FedAvgGlobalModel& operator=(const FedAvgGlobalModel& other) { FedAvgWeightsMessage::operator=(other); return *this; }
+    virtual FedAvgGlobalModel *dup() const override { return new FedAvgGlobalModel(*this); }
+};
+
+} // namespace inet
+
+#endif
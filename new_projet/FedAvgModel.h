@@ -1,97 +1,571 @@
-#ifndef __FEDAVGMODEL_H
-#define __FEDAVGMODEL_H
-
-#include <vector>
-#include <random>
-#include <algorithm>
-#include <numeric>
-#include <cmath>
-
-// A simple neural network model for demonstration purposes
-class FedAvgModel {
-private:
-    std::vector<double> weights;
-    int inputSize;
-    int outputSize;
-
-    // Random number generator for simulated training
-    std::mt19937 rng;
-
-public:
-    // Initialize model with random weights
-    FedAvgModel(int inputSize = 10, int outputSize = 2)
-        : inputSize(inputSize), outputSize(outputSize) {
-
-        // Seed random number generator
-        std::random_device rd;
-        rng = std::mt19937(rd());
-
-        // Initialize weights with small random values
-        int totalWeights = inputSize * outputSize;
-        weights.resize(totalWeights);
-
-        std::uniform_real_distribution<double> dist(-0.1, 0.1);
-        for (int i = 0; i < totalWeights; i++) {
-            weights[i] = dist(rng);
-        }
-    }
-
-    // Set model weights directly
-    void setWeights(const std::vector<double>& newWeights) {
-        if (newWeights.size() != weights.size()) {
-            throw std::runtime_error("Weight dimensions do not match");
-        }
-        weights = newWeights;
-    }
-
-    // Get model weights
-    const std::vector<double>& getWeights() const {
-        return weights;
-    }
-
-    // Simulate local training on data
-    // Returns: pair(loss, number of samples used)
-    std::pair<double, int> train(int numSamples) {
-        // Simulate training by adding small perturbations to weights
-        std::normal_distribution<double> dist(0.0, 0.01);
-
-        for (auto& w : weights) {
-            w += dist(rng);
-        }
-
-        // Simulate a decreasing loss value
-        // (in real implementation, this would be calculated from actual training)
-        double simulatedLoss = 1.0 / (1.0 + 0.1 * numSamples);
-
-        return {simulatedLoss, numSamples};
-    }
-
-    // Predict function (simplified for simulation)
-    std::vector<double> predict(const std::vector<double>& input) {
-        if (input.size() != inputSize) {
-            throw std::runtime_error("Input size mismatch");
-        }
-
-        std::vector<double> output(outputSize, 0.0);
-        for (int i = 0; i < outputSize; i++) {
-            for (int j = 0; j < inputSize; j++) {
-                output[i] += input[j] * weights[j * outputSize + i];
-            }
-        }
-
-        return output;
-    }
-
-    // Evaluate model performance (simplified)
-    double evaluate(int numSamples) {
-        // Simulate evaluation with a random accuracy between 0.5 and 1.0
-        // Higher values for more training samples
-        std::uniform_real_distribution<double> dist(0.5, 1.0);
-        double baseAccuracy = dist(rng);
-
-        // Accuracy improves with more samples but plateaus
-        return baseAccuracy * (1.0 - exp(-0.001 * numSamples));
-    }
-};
-
-#endif
+#ifndef __FEDAVGMODEL_H
+#define __FEDAVGMODEL_H
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Scalar type of model parameters and message weight buffers. Building with
+// -DFEDAVG_USE_FLOAT (see makefrag) runs the whole scenario in float32;
+// aggregation still accumulates in FedAvgAccumulator.
+#ifdef FEDAVG_USE_FLOAT
+typedef float FedAvgScalar;
+#else
+typedef double FedAvgScalar;
+#endif
+typedef double FedAvgAccumulator;
+
+inline const char *fedAvgScalarName() {
+    return sizeof(FedAvgScalar) == sizeof(float) ? "float" : "double";
+}
+
+// Activation applied to the output of a dense layer
+enum class Activation { IDENTITY, RELU, SIGMOID, TANH };
+
+inline Activation parseActivation(const std::string& name) {
+    if (name == "identity" || name == "linear") return Activation::IDENTITY;
+    if (name == "relu") return Activation::RELU;
+    if (name == "sigmoid") return Activation::SIGMOID;
+    if (name == "tanh") return Activation::TANH;
+    throw std::invalid_argument("Unknown activation: " + name);
+}
+
+template<typename Scalar>
+inline Scalar applyActivation(Activation activation, Scalar x) {
+    switch (activation) {
+        case Activation::RELU: return x > Scalar(0) ? x : Scalar(0);
+        case Activation::SIGMOID: return Scalar(1) / (Scalar(1) + std::exp(-x));
+        case Activation::TANH: return std::tanh(x);
+        default: return x;
+    }
+}
+
+// Derivative of the activation, expressed through its output y
+template<typename Scalar>
+inline Scalar activationDerivative(Activation activation, Scalar y) {
+    switch (activation) {
+        case Activation::RELU: return y > Scalar(0) ? Scalar(1) : Scalar(0);
+        case Activation::SIGMOID: return y * (Scalar(1) - y);
+        case Activation::TANH: return Scalar(1) - y * y;
+        default: return Scalar(1);
+    }
+}
+
+// Class predicted from the model outputs: a single output is a binary
+// classifier thresholded at 0, otherwise the largest output wins
+template<typename Scalar>
+inline int predictedClass(const Scalar* outputs, int numOutputs) {
+    if (numOutputs == 1) {
+        return outputs[0] > Scalar(0) ? 1 : 0;
+    }
+    return static_cast<int>(std::max_element(outputs, outputs + numOutputs) - outputs);
+}
+
+// Softmax cross-entropy of the outputs (logistic loss for a single output)
+template<typename Scalar>
+inline double crossEntropyLoss(const Scalar* outputs, int numOutputs, int label) {
+    if (numOutputs == 1) {
+        double z = outputs[0];
+        double margin = label == 1 ? z : -z;
+        return std::log1p(std::exp(-std::fabs(margin))) + std::max(-margin, 0.0);
+    }
+    double maxOutput = *std::max_element(outputs, outputs + numOutputs);
+    double sum = 0;
+    for (int k = 0; k < numOutputs; k++) {
+        sum += std::exp(outputs[k] - maxOutput);
+    }
+    return std::log(sum) + maxOutput - outputs[label];
+}
+
+// Gradient of crossEntropyLoss with respect to the outputs
+template<typename Scalar>
+inline void crossEntropyGradient(const Scalar* outputs, int numOutputs, int label, Scalar* gradient) {
+    if (numOutputs == 1) {
+        double p = 1.0 / (1.0 + std::exp(-static_cast<double>(outputs[0])));
+        gradient[0] = static_cast<Scalar>(p - (label == 1 ? 1.0 : 0.0));
+        return;
+    }
+    double maxOutput = *std::max_element(outputs, outputs + numOutputs);
+    double sum = 0;
+    for (int k = 0; k < numOutputs; k++) {
+        sum += std::exp(outputs[k] - maxOutput);
+    }
+    for (int k = 0; k < numOutputs; k++) {
+        double p = std::exp(outputs[k] - maxOutput) / sum;
+        gradient[k] = static_cast<Scalar>(p - (k == label ? 1.0 : 0.0));
+    }
+}
+
+// One dense layer: output = activation(input * W + b)
+struct LayerSpec {
+    int inputSize;
+    int outputSize;
+    Activation activation;
+};
+
+// Description of a feed-forward model as a stack of dense layers
+struct ModelArchitecture {
+    std::vector<LayerSpec> layers;
+
+    // Build a stack of dense layers from the list of layer widths,
+    // e.g. {10, 16, 2} gives a 10x16 hidden layer and a 16x2 output layer
+    static ModelArchitecture dense(const std::vector<int>& sizes,
+                                   Activation hidden = Activation::RELU,
+                                   Activation output = Activation::IDENTITY) {
+        if (sizes.size() < 2) {
+            throw std::invalid_argument("A model needs at least an input and an output size");
+        }
+        ModelArchitecture arch;
+        for (size_t i = 0; i + 1 < sizes.size(); i++) {
+            if (sizes[i] <= 0 || sizes[i + 1] <= 0) {
+                throw std::invalid_argument("Layer sizes must be positive");
+            }
+            bool last = (i + 2 == sizes.size());
+            arch.layers.push_back({sizes[i], sizes[i + 1], last ? output : hidden});
+        }
+        return arch;
+    }
+
+    // Parse a whitespace-separated list of layer widths, e.g. "10 16 2"
+    static ModelArchitecture parse(const std::string& layerSizes,
+                                   const std::string& hidden = "relu",
+                                   const std::string& output = "identity") {
+        std::istringstream in(layerSizes);
+        std::vector<int> sizes;
+        int size;
+        while (in >> size) {
+            sizes.push_back(size);
+        }
+        if (!in.eof()) {
+            throw std::invalid_argument("Malformed layer sizes: " + layerSizes);
+        }
+        return dense(sizes, parseActivation(hidden), parseActivation(output));
+    }
+
+    int inputSize() const { return layers.front().inputSize; }
+    int outputSize() const { return layers.back().outputSize; }
+
+    // Total number of parameters (weights and biases of all layers)
+    size_t numParameters() const {
+        size_t total = 0;
+        for (const auto& layer : layers) {
+            total += static_cast<size_t>(layer.inputSize) * layer.outputSize + layer.outputSize;
+        }
+        return total;
+    }
+
+    std::string str() const {
+        std::ostringstream out;
+        out << layers.front().inputSize;
+        for (const auto& layer : layers) {
+            out << "-" << layer.outputSize;
+        }
+        return out.str();
+    }
+};
+
+// Allocator returning cache-line aligned storage for the parameter arena
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+    template<typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() noexcept {}
+    template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(size_t n) {
+        void *p = ::operator new(n * sizeof(T), std::align_val_t(Alignment));
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+    template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+// All model parameters live in one contiguous, aligned buffer.
+// Layer i occupies [W_i (in x out, input-major) | b_i (out)] in order.
+template<typename Scalar>
+using ParameterArenaT = std::vector<Scalar, AlignedAllocator<Scalar>>;
+typedef ParameterArenaT<FedAvgScalar> ParameterArena;
+
+// Slice of the flat parameter arena owned by one base station shard
+struct ShardRange {
+    size_t offset;
+    size_t length;
+};
+
+// Split numParameters into numShards contiguous slices whose lengths differ
+// by at most one; every node computes the same partition
+inline ShardRange shardRange(size_t numParameters, int numShards, int shardIndex) {
+    if (numShards <= 0 || shardIndex < 0 || shardIndex >= numShards) {
+        throw std::invalid_argument("Invalid shard index");
+    }
+    size_t base = numParameters / numShards;
+    size_t extra = numParameters % numShards;
+    size_t index = shardIndex;
+    return {index * base + std::min(index, extra), base + (index < extra ? 1 : 0)};
+}
+
+// Checksum over the flat parameter arena (64-bit FNV-1a over scalar words)
+template<typename Scalar>
+inline uint64_t computeChecksum(const Scalar* data, size_t count) {
+    static_assert(sizeof(Scalar) <= sizeof(uint64_t), "Scalar too wide for checksum");
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t word = 0;
+        std::memcpy(&word, &data[i], sizeof(Scalar));
+        hash ^= word;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Dense forward kernel for a shape known at compile time; the fixed trip
+// counts let the compiler fully unroll and vectorize the inner loop
+template<typename Scalar, int In, int Out>
+inline void denseKernelFixed(const Scalar* x, const Scalar* W, const Scalar* b, Scalar* y) {
+    Scalar acc[Out];
+    for (int i = 0; i < Out; i++) {
+        acc[i] = b[i];
+    }
+    for (int j = 0; j < In; j++) {
+        const Scalar xj = x[j];
+        const Scalar* row = W + j * Out;
+        for (int i = 0; i < Out; i++) {
+            acc[i] += xj * row[i];
+        }
+    }
+    for (int i = 0; i < Out; i++) {
+        y[i] = acc[i];
+    }
+}
+
+// Generic dense forward kernel for arbitrary shapes
+template<typename Scalar>
+inline void denseKernel(int in, int out, const Scalar* x, const Scalar* W, const Scalar* b, Scalar* y) {
+    for (int i = 0; i < out; i++) {
+        y[i] = b[i];
+    }
+    for (int j = 0; j < in; j++) {
+        const Scalar xj = x[j];
+        const Scalar* row = W + static_cast<size_t>(j) * out;
+        for (int i = 0; i < out; i++) {
+            y[i] += xj * row[i];
+        }
+    }
+}
+
+template<typename Scalar>
+using DenseKernelFn = void (*)(const Scalar*, const Scalar*, const Scalar*, Scalar*);
+
+// Returns a specialized kernel for common small shapes, or nullptr
+template<typename Scalar>
+inline DenseKernelFn<Scalar> selectDenseKernel(int in, int out) {
+#define FEDAVG_FIXED_KERNEL(I, O) if (in == I && out == O) return &denseKernelFixed<Scalar, I, O>;
+    FEDAVG_FIXED_KERNEL(10, 2)
+    FEDAVG_FIXED_KERNEL(10, 8)
+    FEDAVG_FIXED_KERNEL(10, 16)
+    FEDAVG_FIXED_KERNEL(10, 32)
+    FEDAVG_FIXED_KERNEL(8, 2)
+    FEDAVG_FIXED_KERNEL(8, 8)
+    FEDAVG_FIXED_KERNEL(16, 2)
+    FEDAVG_FIXED_KERNEL(16, 16)
+    FEDAVG_FIXED_KERNEL(32, 2)
+    FEDAVG_FIXED_KERNEL(32, 32)
+#undef FEDAVG_FIXED_KERNEL
+    return nullptr;
+}
+
+// View of one layer's parameters inside the arena
+template<typename Scalar>
+struct LayerView {
+    const LayerSpec* spec;
+    Scalar* weights;
+    Scalar* bias;
+};
+
+// A configurable feed-forward model used for the simulation
+template<typename Scalar>
+class FedAvgModelT {
+public:
+    typedef Scalar ScalarType;
+    typedef ParameterArenaT<Scalar> Arena;
+
+private:
+    struct LayerLayout {
+        LayerSpec spec;
+        size_t weightOffset;
+        size_t biasOffset;
+        DenseKernelFn<Scalar> kernel;
+    };
+
+    ModelArchitecture architecture;
+    Arena parameters;
+    std::vector<LayerLayout> layout;
+
+    // Random number generator for weight initialization and sample shuffling
+    std::mt19937 rng;
+
+    // Apply one layer to a single input row
+    void forwardLayer(const LayerLayout& l, const Scalar* input, std::vector<Scalar>& output) const {
+        output.resize(l.spec.outputSize);
+        const Scalar* W = parameters.data() + l.weightOffset;
+        const Scalar* b = parameters.data() + l.biasOffset;
+        if (l.kernel)
+            l.kernel(input, W, b, output.data());
+        else
+            denseKernel(l.spec.inputSize, l.spec.outputSize, input, W, b, output.data());
+        if (l.spec.activation != Activation::IDENTITY) {
+            for (auto& v : output) {
+                v = applyActivation(l.spec.activation, v);
+            }
+        }
+    }
+
+public:
+    // Initialize model with random weights
+    explicit FedAvgModelT(const ModelArchitecture& arch) {
+        // Seed random number generator
+        std::random_device rd;
+        rng = std::mt19937(rd());
+
+        configure(arch);
+    }
+
+    FedAvgModelT(int inputSize = 10, int outputSize = 2)
+        : FedAvgModelT(ModelArchitecture::dense({inputSize, outputSize}, Activation::IDENTITY, Activation::IDENTITY)) {
+    }
+
+    // Rebuild the model for a new architecture and reinitialize its weights
+    void configure(const ModelArchitecture& arch) {
+        if (arch.layers.empty()) {
+            throw std::invalid_argument("Model architecture has no layers");
+        }
+        for (size_t i = 1; i < arch.layers.size(); i++) {
+            if (arch.layers[i].inputSize != arch.layers[i - 1].outputSize) {
+                throw std::invalid_argument("Layer sizes do not chain");
+            }
+        }
+
+        architecture = arch;
+        layout.clear();
+        size_t offset = 0;
+        for (const auto& spec : architecture.layers) {
+            LayerLayout l;
+            l.spec = spec;
+            l.weightOffset = offset;
+            offset += static_cast<size_t>(spec.inputSize) * spec.outputSize;
+            l.biasOffset = offset;
+            offset += spec.outputSize;
+            l.kernel = selectDenseKernel<Scalar>(spec.inputSize, spec.outputSize);
+            layout.push_back(l);
+        }
+
+        // Initialize weights with small random values, biases with zero
+        parameters.assign(offset, Scalar(0));
+        std::uniform_real_distribution<Scalar> dist(Scalar(-0.1), Scalar(0.1));
+        for (const auto& l : layout) {
+            for (size_t i = l.weightOffset; i < l.biasOffset; i++) {
+                parameters[i] = dist(rng);
+            }
+        }
+    }
+
+    const ModelArchitecture& getArchitecture() const {
+        return architecture;
+    }
+
+    size_t getNumParameters() const {
+        return parameters.size();
+    }
+
+    size_t getNumLayers() const {
+        return layout.size();
+    }
+
+    LayerView<Scalar> getLayer(size_t i) {
+        LayerLayout& l = layout.at(i);
+        return {&l.spec, parameters.data() + l.weightOffset, parameters.data() + l.biasOffset};
+    }
+
+    // Set model weights directly from a flat parameter buffer
+    void setWeights(const Scalar* data, size_t count) {
+        if (count != parameters.size()) {
+            throw std::runtime_error("Weight dimensions do not match");
+        }
+        std::copy(data, data + count, parameters.begin());
+    }
+
+    template<typename Container>
+    void setWeights(const Container& newWeights) {
+        setWeights(newWeights.data(), newWeights.size());
+    }
+
+    // Get model weights as the flat parameter arena
+    const Arena& getWeights() const {
+        return parameters;
+    }
+
+    Arena& getMutableWeights() {
+        return parameters;
+    }
+
+    uint64_t checksum() const {
+        return computeChecksum(parameters.data(), parameters.size());
+    }
+
+    // Local SGD on count labelled samples; features holds one row of
+    // inputSize values per sample. Samples are visited in a new random
+    // order each epoch and the loss is softmax cross-entropy.
+    // Returns: pair(mean loss over the last epoch, number of samples used)
+    std::pair<double, int> train(const Scalar* features, const int* labels, size_t count,
+                                 double learningRate, int epochs) {
+        if (count == 0 || epochs <= 0) {
+            return {0.0, 0};
+        }
+
+        const size_t numLayers = layout.size();
+        const int inputSize = architecture.inputSize();
+        const int numOutputs = architecture.outputSize();
+        const Scalar lr = static_cast<Scalar>(learningRate);
+
+        // activations[i] is the input of layer i, activations.back() the output
+        std::vector<std::vector<Scalar>> activations(numLayers + 1);
+        std::vector<Scalar> delta, previousDelta;
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), size_t(0));
+
+        double totalLoss = 0;
+        for (int epoch = 0; epoch < epochs; epoch++) {
+            std::shuffle(order.begin(), order.end(), rng);
+            totalLoss = 0;
+            for (size_t r : order) {
+                const Scalar* x = features + r * inputSize;
+                activations[0].assign(x, x + inputSize);
+                for (size_t i = 0; i < numLayers; i++) {
+                    forwardLayer(layout[i], activations[i].data(), activations[i + 1]);
+                }
+                const std::vector<Scalar>& outputs = activations.back();
+                totalLoss += crossEntropyLoss(outputs.data(), numOutputs, labels[r]);
+
+                // Back-propagate from the outputs; each layer passes its
+                // delta down before its own weights are updated
+                delta.resize(numOutputs);
+                crossEntropyGradient(outputs.data(), numOutputs, labels[r], delta.data());
+                for (size_t i = numLayers; i-- > 0;) {
+                    const LayerLayout& l = layout[i];
+                    const int in = l.spec.inputSize;
+                    const int out = l.spec.outputSize;
+                    const std::vector<Scalar>& y = activations[i + 1];
+                    const std::vector<Scalar>& a = activations[i];
+                    Scalar* W = parameters.data() + l.weightOffset;
+                    Scalar* b = parameters.data() + l.biasOffset;
+
+                    for (int k = 0; k < out; k++) {
+                        delta[k] *= activationDerivative(l.spec.activation, y[k]);
+                    }
+                    if (i > 0) {
+                        previousDelta.resize(in);
+                        for (int j = 0; j < in; j++) {
+                            const Scalar* row = W + static_cast<size_t>(j) * out;
+                            Scalar sum = 0;
+                            for (int k = 0; k < out; k++) {
+                                sum += row[k] * delta[k];
+                            }
+                            previousDelta[j] = sum;
+                        }
+                    }
+                    for (int j = 0; j < in; j++) {
+                        const Scalar step = lr * a[j];
+                        Scalar* row = W + static_cast<size_t>(j) * out;
+                        for (int k = 0; k < out; k++) {
+                            row[k] -= step * delta[k];
+                        }
+                    }
+                    for (int k = 0; k < out; k++) {
+                        b[k] -= lr * delta[k];
+                    }
+                    if (i > 0) {
+                        delta.swap(previousDelta);
+                    }
+                }
+            }
+        }
+
+        return {totalLoss / count, static_cast<int>(count)};
+    }
+
+    // Forward pass through all layers
+    template<typename Input>
+    std::vector<Scalar> predict(const Input& input) const {
+        if (input.size() != static_cast<size_t>(architecture.inputSize())) {
+            throw std::runtime_error("Input size mismatch");
+        }
+
+        std::vector<Scalar> current(input.begin(), input.end());
+        std::vector<Scalar> next;
+        for (const auto& l : layout) {
+            forwardLayer(l, current.data(), next);
+            current.swap(next);
+        }
+
+        return current;
+    }
+
+    // Batched forward pass: inputs holds count rows of inputSize values and
+    // outputs receives count rows of outputSize values. Each layer is applied
+    // to the whole batch before moving on, so its weights stay in cache.
+    void predictBatch(const Scalar* inputs, size_t count, std::vector<Scalar>& outputs,
+                      std::vector<Scalar>& scratch) const {
+        const Scalar* current = inputs;
+        std::vector<Scalar>* buffers[2] = {&outputs, &scratch};
+        // Alternate buffers so the last layer writes into outputs
+        size_t target = (layout.size() % 2 == 1) ? 0 : 1;
+        for (const auto& l : layout) {
+            std::vector<Scalar>& next = *buffers[target];
+            const size_t in = l.spec.inputSize;
+            const size_t out = l.spec.outputSize;
+            next.resize(count * out);
+            const Scalar* W = parameters.data() + l.weightOffset;
+            const Scalar* b = parameters.data() + l.biasOffset;
+            if (l.kernel) {
+                for (size_t r = 0; r < count; r++) {
+                    l.kernel(current + r * in, W, b, next.data() + r * out);
+                }
+            }
+            else {
+                for (size_t r = 0; r < count; r++) {
+                    denseKernel(l.spec.inputSize, l.spec.outputSize, current + r * in, W, b, next.data() + r * out);
+                }
+            }
+            if (l.spec.activation != Activation::IDENTITY) {
+                for (auto& v : next) {
+                    v = applyActivation(l.spec.activation, v);
+                }
+            }
+            current = next.data();
+            target ^= 1;
+        }
+    }
+
+    // Reseed the generator, e.g. to make the next configure() reproducible
+    void seed(unsigned int value) {
+        rng.seed(value);
+    }
+};
+
+typedef FedAvgModelT<FedAvgScalar> FedAvgModel;
+
+#endif
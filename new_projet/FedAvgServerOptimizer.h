@@ -0,0 +1,127 @@
+#ifndef __FEDAVGSERVEROPTIMIZER_H
+#define __FEDAVGSERVEROPTIMIZER_H
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include "FedAvgModel.h"
+
+// Update rule applied by the server to the aggregated model
+enum class ServerOptimizerType {
+    NONE,       // Replace the global model with the aggregate (plain FedAvg)
+    MOMENTUM,   // Server momentum (FedAvgM)
+    ADAM,       // FedAdam
+    YOGI        // FedYogi
+};
+
+inline ServerOptimizerType parseServerOptimizerType(const std::string& name) {
+    if (name == "none") return ServerOptimizerType::NONE;
+    if (name == "momentum") return ServerOptimizerType::MOMENTUM;
+    if (name == "adam") return ServerOptimizerType::ADAM;
+    if (name == "yogi") return ServerOptimizerType::YOGI;
+    throw std::invalid_argument("Unknown server optimizer: " + name);
+}
+
+// Server-side optimizer treating the difference between the aggregated and
+// the current global model as a pseudo-gradient (Reddi et al., "Adaptive
+// Federated Optimization"). Moment estimates are kept in flat accumulator
+// buffers parallel to the parameter arena.
+template<typename Scalar>
+class FedAvgServerOptimizer {
+  private:
+    ServerOptimizerType type = ServerOptimizerType::NONE;
+    double learningRate = 1.0;
+    double beta1 = 0.9;         // Momentum / first moment decay
+    double beta2 = 0.99;        // Second moment decay (adam, yogi)
+    double epsilon = 1e-3;      // Adaptivity floor tau (adam, yogi)
+
+    std::vector<FedAvgAccumulator> firstMoment;
+    std::vector<FedAvgAccumulator> secondMoment;
+
+  public:
+    FedAvgServerOptimizer() {}
+
+    void configure(ServerOptimizerType type, double learningRate, double beta1, double beta2, double epsilon) {
+        if (learningRate <= 0) {
+            throw std::invalid_argument("Server learning rate must be positive");
+        }
+        if (beta1 < 0 || beta1 >= 1 || beta2 < 0 || beta2 >= 1) {
+            throw std::invalid_argument("Server optimizer betas must be in [0, 1)");
+        }
+        if (epsilon <= 0) {
+            throw std::invalid_argument("Server optimizer epsilon must be positive");
+        }
+        this->type = type;
+        this->learningRate = learningRate;
+        this->beta1 = beta1;
+        this->beta2 = beta2;
+        this->epsilon = epsilon;
+        reset();
+    }
+
+    ServerOptimizerType getType() const { return type; }
+
+    // Drop the moment estimates; they are rebuilt on the next step
+    void reset() {
+        firstMoment.clear();
+        secondMoment.clear();
+    }
+
+    // Move the d global weights towards the aggregated weights
+    void step(Scalar* global, const Scalar* aggregated, size_t d) {
+        if (type == ServerOptimizerType::NONE && learningRate == 1.0) {
+            std::copy(aggregated, aggregated + d, global);
+            return;
+        }
+
+        if (type != ServerOptimizerType::NONE && firstMoment.size() != d) {
+            firstMoment.assign(d, FedAvgAccumulator(0));
+            secondMoment.assign(type == ServerOptimizerType::ADAM || type == ServerOptimizerType::YOGI ? d : 0,
+                                FedAvgAccumulator(epsilon * epsilon));
+        }
+
+        const FedAvgAccumulator lr = learningRate;
+        const FedAvgAccumulator b1 = beta1;
+        const FedAvgAccumulator b2 = beta2;
+        const FedAvgAccumulator tau = epsilon;
+
+        switch (type) {
+            case ServerOptimizerType::NONE:
+                for (size_t i = 0; i < d; i++) {
+                    FedAvgAccumulator delta = FedAvgAccumulator(aggregated[i]) - global[i];
+                    global[i] = static_cast<Scalar>(global[i] + lr * delta);
+                }
+                break;
+            case ServerOptimizerType::MOMENTUM:
+                for (size_t i = 0; i < d; i++) {
+                    FedAvgAccumulator delta = FedAvgAccumulator(aggregated[i]) - global[i];
+                    firstMoment[i] = b1 * firstMoment[i] + delta;
+                    global[i] = static_cast<Scalar>(global[i] + lr * firstMoment[i]);
+                }
+                break;
+            case ServerOptimizerType::ADAM:
+                for (size_t i = 0; i < d; i++) {
+                    FedAvgAccumulator delta = FedAvgAccumulator(aggregated[i]) - global[i];
+                    firstMoment[i] = b1 * firstMoment[i] + (1 - b1) * delta;
+                    secondMoment[i] = b2 * secondMoment[i] + (1 - b2) * delta * delta;
+                    global[i] = static_cast<Scalar>(global[i] + lr * firstMoment[i] / (std::sqrt(secondMoment[i]) + tau));
+                }
+                break;
+            case ServerOptimizerType::YOGI:
+                for (size_t i = 0; i < d; i++) {
+                    FedAvgAccumulator delta = FedAvgAccumulator(aggregated[i]) - global[i];
+                    FedAvgAccumulator sq = delta * delta;
+                    FedAvgAccumulator diff = secondMoment[i] - sq;
+                    FedAvgAccumulator sign = diff > 0 ? 1 : (diff < 0 ? -1 : 0);
+                    firstMoment[i] = b1 * firstMoment[i] + (1 - b1) * delta;
+                    secondMoment[i] = secondMoment[i] - (1 - b2) * sq * sign;
+                    global[i] = static_cast<Scalar>(global[i] + lr * firstMoment[i] / (std::sqrt(secondMoment[i]) + tau));
+                }
+                break;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef __FEDAVGUPLOADSCHEDULER_H
+#define __FEDAVGUPLOADSCHEDULER_H
+
+#include <algorithm>
+#include <cmath>
+
+// Position and velocity of a node (m, m/s)
+struct KinematicState {
+    double x = 0, y = 0, z = 0;
+    double vx = 0, vy = 0, vz = 0;
+};
+
+// Picks when a UAV should upload its model update. The UAV's trajectory is
+// extrapolated with a constant speed, constant turn rate model (which
+// follows circular orbits), and the link quality along it is predicted
+// with a log-distance path loss model whose intercept is learned from the
+// SNIR of packets received from the base station. That intercept describes
+// the downlink; the uplink prediction shifts it by the difference of the
+// UAV and base station transmit powers. Link failures (frames
+// the MAC gave up on) raise the required SNIR margin, successful
+// receptions let it decay again.
+class FedAvgUploadScheduler {
+  private:
+    // Configuration
+    double pathLossExponent = 2.0;
+    double requiredSnirDb = 10.0;
+    double minGainDb = 1.0;         // Smaller predicted gains are not worth waiting for
+    double marginStepDb = 2.0;      // Added to the required SNIR per link failure
+    double maxMarginDb = 10.0;
+    double smoothing = 0.2;         // EWMA weight of new SNIR observations
+    double uplinkOffsetDb = 0;      // UAV minus base station transmit power
+
+    // Learned state
+    bool haveIntercept = false;
+    double interceptDb = 0;         // Predicted SNIR at 1 m
+    double marginDb = 0;
+    bool haveMotion = false;
+    double lastMotionTime = 0;
+    double lastHeading = 0;
+    double turnRate = 0;            // rad/s in the horizontal plane
+
+  public:
+    FedAvgUploadScheduler() {}
+
+    void configure(double pathLossExponent, double requiredSnirDb, double minGainDb, double marginStepDb,
+                   double uplinkOffsetDb) {
+        this->pathLossExponent = pathLossExponent;
+        this->uplinkOffsetDb = uplinkOffsetDb;
+        this->requiredSnirDb = requiredSnirDb;
+        this->minGainDb = minGainDb;
+        this->marginStepDb = marginStepDb;
+    }
+
+    // Feed a mobility sample taken at time t to track the turn rate
+    void observeMotion(double t, const KinematicState& state) {
+        double speed = std::hypot(state.vx, state.vy);
+        if (speed < 1e-6) {
+            turnRate = 0;
+            return;
+        }
+        double heading = std::atan2(state.vy, state.vx);
+        if (haveMotion && t > lastMotionTime) {
+            double delta = std::remainder(heading - lastHeading, 2 * M_PI);
+            turnRate = delta / (t - lastMotionTime);
+        }
+        haveMotion = true;
+        lastMotionTime = t;
+        lastHeading = heading;
+    }
+
+    // Feed the SNIR (dB) of a packet received at the given distance (m)
+    void observeSnir(double distance, double snirDb) {
+        double intercept = snirDb + 10 * pathLossExponent * std::log10(std::max(distance, 1.0));
+        interceptDb = haveIntercept ? (1 - smoothing) * interceptDb + smoothing * intercept : intercept;
+        haveIntercept = true;
+        marginDb = std::max(0.0, marginDb - marginStepDb / 4);
+    }
+
+    void observeLinkFailure() {
+        marginDb = std::min(maxMarginDb, marginDb + marginStepDb);
+    }
+
+    double getMarginDb() const { return marginDb; }
+    double getTurnRate() const { return turnRate; }
+
+    // Extrapolate the state dt seconds ahead
+    KinematicState predict(const KinematicState& state, double dt) const {
+        KinematicState future = state;
+        future.z += state.vz * dt;
+        if (std::fabs(turnRate) < 1e-9) {
+            future.x += state.vx * dt;
+            future.y += state.vy * dt;
+            return future;
+        }
+        // Integrate the velocity rotating at turnRate
+        double a = turnRate * dt;
+        double s = std::sin(a), c = std::cos(a);
+        future.x += (state.vx * s - state.vy * (1 - c)) / turnRate;
+        future.y += (state.vy * s + state.vx * (1 - c)) / turnRate;
+        future.vx = state.vx * c - state.vy * s;
+        future.vy = state.vx * s + state.vy * c;
+        return future;
+    }
+
+    // Predicted uplink SNIR at distance d; relative to an unknown constant
+    // until the first SNIR observation arrives
+    double predictSnirDb(double distance) const {
+        return interceptDb + uplinkOffsetDb - 10 * pathLossExponent * std::log10(std::max(distance, 1.0));
+    }
+
+    // Returns how long to wait before uploading (0 = now), looking ahead at
+    // most horizon seconds in steps of step seconds. target is the position
+    // of the base station.
+    double chooseUploadDelay(const KinematicState& state, const KinematicState& target,
+                             double horizon, double step) const {
+        if (horizon <= 0 || step <= 0) {
+            return 0;
+        }
+
+        double nowSnir = predictSnirDb(distance(state, target));
+        double requiredDb = requiredSnirDb + marginDb;
+        if (haveIntercept && nowSnir >= requiredDb) {
+            return 0;
+        }
+
+        double bestSnir = nowSnir;
+        for (double t = step; t <= horizon; t += step) {
+            bestSnir = std::max(bestSnir, predictSnirDb(distance(predict(state, t), target)));
+        }
+        if (bestSnir - nowSnir < minGainDb) {
+            return 0;
+        }
+
+        // Earliest time that is good enough: meets the requirement if it
+        // can be met, otherwise comes within half a dB of the best window
+        double goal = haveIntercept ? std::min(requiredDb, bestSnir - 0.5) : bestSnir - 0.5;
+        for (double t = step; t <= horizon; t += step) {
+            if (predictSnirDb(distance(predict(state, t), target)) >= goal) {
+                return t;
+            }
+        }
+        return 0;
+    }
+
+  protected:
+    static double distance(const KinematicState& a, const KinematicState& b) {
+        return std::sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z));
+    }
+};
+
+#endif
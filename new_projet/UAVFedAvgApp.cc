@@ -6,6 +6,8 @@
 #include "inet/transportlayer/contract/udp/UdpControlInfo_m.h"
 #include "inet/networklayer/common/L3AddressTag_m.h"
 #include "inet/common/packet/chunk/cPacketChunk.h"
+#include "inet/common/Simsignals.h"
+#include "inet/physicallayer/wireless/common/contract/packetlevel/SignalTag_m.h"
 
 Define_Module(UAVFedAvgApp);
 
@@ -13,13 +15,17 @@ simsignal_t UAVFedAvgApp::sentPkSignal = registerSignal("sentPk");
 simsignal_t UAVFedAvgApp::rcvdPkSignal = registerSignal("rcvdPk");
 simsignal_t UAVFedAvgApp::roundCompletedSignal = registerSignal("roundCompleted");
 simsignal_t UAVFedAvgApp::trainingLossSignal = registerSignal("trainingLoss");
+simsignal_t UAVFedAvgApp::uploadDelaySignal = registerSignal("uploadDelay");
 
-UAVFedAvgApp::UAVFedAvgApp() : localModel(10, 2) {
+UAVFedAvgApp::UAVFedAvgApp() {
 }
 
 UAVFedAvgApp::~UAVFedAvgApp() {
     cancelAndDelete(sensorDataTimer);
     cancelAndDelete(trainingTimer);
+    cancelAndDelete(uploadTimer);
+    if (host != nullptr && host->isSubscribed(linkBrokenSignal, this))
+        host->unsubscribe(linkBrokenSignal, this);
 }
 
 void UAVFedAvgApp::initialize(int stage) {
@@ -31,6 +37,28 @@ void UAVFedAvgApp::initialize(int stage) {
         localPort = par("localPort");
         destPort = par("destPort");
         dataCollectionSize = par("dataCollectionSize");
+        uploadScheduling = par("uploadScheduling");
+        uploadDeadline = par("uploadDeadline");
+        uploadPredictionStep = par("uploadPredictionStep");
+        uploadScheduler.configure(par("pathLossExponent").doubleValue(), par("requiredSnir").doubleValue(),
+                par("minUploadGain").doubleValue(), par("linkFailureMargin").doubleValue(),
+                par("uplinkPowerOffset").doubleValue());
+
+        try {
+            localModel.configure(ModelArchitecture::parse(par("layerSizes").stdstringValue(),
+                    par("hiddenActivation").stdstringValue(), par("outputActivation").stdstringValue()));
+        }
+        catch (const std::invalid_argument& e) {
+            throw cRuntimeError("Invalid model description: %s", e.what());
+        }
+        if (par("scalarType").stdstringValue() != fedAvgScalarName())
+            throw cRuntimeError("Scenario requests %s weights but the model was built with %s (see makefrag)",
+                    par("scalarType").stringValue(), fedAvgScalarName());
+        teacher.configure(localModel.getArchitecture(), par("evalSeed").intValue());
+        learningRate = par("learningRate");
+        localEpochs = par("localEpochs");
+        if (learningRate <= 0 || localEpochs <= 0)
+            throw cRuntimeError("learningRate and localEpochs must be positive");
 
         // Initialize statistics
         numSent = 0;
@@ -39,11 +67,28 @@ void UAVFedAvgApp::initialize(int stage) {
         WATCH(numSent);
         WATCH(numReceived);
         WATCH(numTrainingRounds);
+        WATCH(numDeferredUploads);
+        WATCH(numLinkFailures);
         WATCH(currentRound);
     }
     else if (stage == INITSTAGE_APPLICATION_LAYER) {
         sensorDataTimer = new cMessage("sensorDataTimer");
         trainingTimer = new cMessage("trainingTimer");
+        uploadTimer = new cMessage("uploadTimer");
+
+        if (uploadScheduling) {
+            host = getContainingNode(this);
+            mobility = dynamic_cast<IMobility *>(host->getSubmodule("mobility"));
+            cModule *baseStation = findModuleByPath(par("baseStationModule"));
+            if (baseStation != nullptr)
+                baseStationMobility = dynamic_cast<IMobility *>(baseStation->getSubmodule("mobility"));
+            if (mobility == nullptr || baseStationMobility == nullptr) {
+                EV_WARN << "Mobility of this node or of the base station not found, uploading immediately" << endl;
+                uploadScheduling = false;
+            }
+            else
+                host->subscribe(linkBrokenSignal, this);
+        }
 
         socket.setOutputGate(gate("socketOut"));
         socket.bind(localPort);
@@ -53,12 +98,18 @@ void UAVFedAvgApp::initialize(int stage) {
         cStringTokenizer tokenizer(destAddrs);
         const char *token;
 
+        // Every listed base station is a shard of the parameter server;
+        // sensor data goes to the first one
         while ((token = tokenizer.nextToken()) != nullptr) {
-            L3AddressResolver().tryResolve(token, destAddress);
-            if (destAddress.isUnspecified())
-                EV_ERROR << "Cannot resolve destination address: " << token << endl;
-            break;
+            L3Address address;
+            L3AddressResolver().tryResolve(token, address);
+            // A missing shard would make every shard reject our updates
+            if (address.isUnspecified())
+                throw cRuntimeError("Cannot resolve destination address: %s", token);
+            shardAddresses.push_back(address);
         }
+        if (!shardAddresses.empty())
+            destAddress = shardAddresses.front();
 
         if (destAddress.isUnspecified()) {
             EV_WARN << "No destination address specified, app won't send packets" << endl;
@@ -73,12 +124,18 @@ void UAVFedAvgApp::initialize(int stage) {
 void UAVFedAvgApp::handleMessageWhenUp(cMessage *msg) {
     if (msg->isSelfMessage()) {
         if (msg == sensorDataTimer) {
+            KinematicState state;
+            if (uploadScheduling && getKinematicState(mobility, state))
+                uploadScheduler.observeMotion(simTime().dbl(), state);
             sendSensorData();
             scheduleAt(simTime() + sensorInterval, sensorDataTimer);
         }
         else if (msg == trainingTimer) {
             performLocalTraining();
         }
+        else if (msg == uploadTimer) {
+            sendModelUpdate();
+        }
     }
     else
         socket.processMessage(msg);
@@ -86,24 +143,25 @@ void UAVFedAvgApp::handleMessageWhenUp(cMessage *msg) {
 
 void UAVFedAvgApp::collectSensorData() {
     // Simulate sensor data collection
-    std::vector<double> dataPoint(10); // 10 features per sample
+    std::vector<FedAvgScalar> dataPoint(localModel.getArchitecture().inputSize()); // One feature per model input
 
     // Generate random sensor data
     std::random_device rd;
     std::mt19937 gen(rd());
-    std::normal_distribution<> dist(0, 1);
+    std::normal_distribution<FedAvgScalar> dist(0, 1);
 
     for (auto& value : dataPoint) {
         value = dist(gen);
     }
 
-    // Store data locally
-    localData.push_back(dataPoint);
+    // Store data locally, labelled by the task's teacher model
+    localFeatures.insert(localFeatures.end(), dataPoint.begin(), dataPoint.end());
+    localLabels.push_back(teacher.label(dataPoint));
 
-    EV_INFO << "Collected sensor data: sample #" << localData.size() << endl;
+    EV_INFO << "Collected sensor data: sample #" << localLabels.size() << endl;
 
     // If we've collected enough data, we can train
-    if (localData.size() >= dataCollectionSize && !trainingInProgress) {
+    if (localLabels.size() >= dataCollectionSize && !trainingInProgress) {
         // Schedule training if not already in progress
         EV_INFO << "Enough data collected, scheduling local training" << endl;
         scheduleAt(simTime() + 0.01, trainingTimer);
@@ -111,51 +169,162 @@ void UAVFedAvgApp::collectSensorData() {
 }
 
 void UAVFedAvgApp::performLocalTraining() {
-    EV_INFO << "Starting local training on " << localData.size() << " samples" << endl;
+    EV_INFO << "Starting local training on " << localLabels.size() << " samples" << endl;
     trainingInProgress = true;
 
     // Train the local model
-    auto [loss, samples] = localModel.train(localData.size());
+    auto [loss, samples] = localModel.train(localFeatures.data(), localLabels.data(), localLabels.size(),
+            learningRate, localEpochs);
 
     EV_INFO << "Local training completed. Loss: " << loss << endl;
     emit(trainingLossSignal, loss);
 
-    // Send model update to base station
-    sendModelUpdate();
+    // Capture the update now; a deferred upload must not pick up weights,
+    // round or sample count that changed while it was waiting
+    pendingWeights = localModel.getWeights();
+    pendingRound = currentRound;
+    pendingNumSamples = samples;
+
+    // Send model update to base station, possibly in a better link window
+    scheduleModelUpload();
 
     // Clear training flag
     trainingInProgress = false;
 }
 
+void UAVFedAvgApp::scheduleModelUpload() {
+    cancelEvent(uploadTimer);
+
+    KinematicState self, baseStation;
+    if (!uploadScheduling || !getKinematicState(mobility, self) || !getKinematicState(baseStationMobility, baseStation)) {
+        sendModelUpdate();
+        return;
+    }
+
+    // Look ahead until the round's upload deadline
+    uploadScheduler.observeMotion(simTime().dbl(), self);
+    simtime_t horizon = roundStartTime + uploadDeadline - simTime();
+    double delay = uploadScheduler.chooseUploadDelay(self, baseStation, horizon.dbl(), uploadPredictionStep.dbl());
+    emit(uploadDelaySignal, delay);
+
+    if (delay <= 0) {
+        sendModelUpdate();
+    }
+    else {
+        EV_INFO << "Deferring model upload by " << delay << "s to a better predicted link window" << endl;
+        numDeferredUploads++;
+        scheduleAt(simTime() + delay, uploadTimer);
+    }
+}
+
+bool UAVFedAvgApp::getKinematicState(IMobility *mobility, KinematicState& state) const {
+    if (mobility == nullptr)
+        return false;
+    Coord position = mobility->getCurrentPosition();
+    Coord velocity = mobility->getCurrentVelocity();
+    state.x = position.x;
+    state.y = position.y;
+    state.z = position.z;
+    state.vx = velocity.x;
+    state.vy = velocity.y;
+    state.vz = velocity.z;
+    return true;
+}
+
+void UAVFedAvgApp::observeLinkQuality(Packet *packet) {
+    if (!uploadScheduling)
+        return;
+    auto snirInd = packet->findTag<SnirInd>();
+    if (snirInd == nullptr)
+        return;
+    double snir = snirInd->getAverageSnir();
+    if (snir <= 0)
+        return;
+    double distance = mobility->getCurrentPosition().distance(baseStationMobility->getCurrentPosition());
+    uploadScheduler.observeSnir(distance, 10 * std::log10(snir));
+}
+
+void UAVFedAvgApp::receiveSignal(cComponent *source, simsignal_t signalID, cObject *obj, cObject *details) {
+    if (signalID == linkBrokenSignal) {
+        // The MAC gave up on a frame after exhausting its retries
+        numLinkFailures++;
+        uploadScheduler.observeLinkFailure();
+        EV_INFO << "Link failure reported, upload SNIR margin now " << uploadScheduler.getMarginDb() << "dB" << endl;
+    }
+}
+
 void UAVFedAvgApp::sendModelUpdate() {
-    // Create model update message
-    FedAvgModelUpdate* modelUpdate = new FedAvgModelUpdate();
-    modelUpdate->setUavId(getId());
-    modelUpdate->setWeights(localModel.getWeights());
-    modelUpdate->setNumSamples(localData.size());
-    modelUpdate->setRoundNumber(currentRound);
-    modelUpdate->setTrainingTime(trainingInterval);
-
-    // Create packet to send
-    char msgName[32];
-    sprintf(msgName, "ModelUpdate-%d-Round-%d", getId(), currentRound);
-    Packet *packet = new Packet(msgName);
+    // Each base station shard receives its slice of the weights
+    int numShards = shardAddresses.size();
+    for (int shardIndex = 0; shardIndex < numShards; shardIndex++) {
+        ShardRange range = shardRange(pendingWeights.size(), numShards, shardIndex);
+        const FedAvgScalar *slice = pendingWeights.data() + range.offset;
+
+        // Create model update message
+        FedAvgModelUpdate* modelUpdate = new FedAvgModelUpdate();
+        modelUpdate->setUavId(getId());
+        modelUpdate->setWeights(slice, range.length);
+        modelUpdate->setWeightsChecksum(computeChecksum(slice, range.length));
+        modelUpdate->setShardIndex(shardIndex);
+        modelUpdate->setNumShards(numShards);
+        modelUpdate->setWeightsOffset(range.offset);
+        modelUpdate->setByteLength(fedAvgMessageBytes(range.length));
+        modelUpdate->setNumSamples(pendingNumSamples);
+        modelUpdate->setRoundNumber(pendingRound);
+        modelUpdate->setTrainingTime(trainingInterval);
+
+        // Create packet to send
+        char msgName[48];
+        sprintf(msgName, "ModelUpdate-%d-Round-%d-Shard-%d", getId(), pendingRound, shardIndex);
+        Packet *packet = new Packet(msgName);
+
+        // Add creation time tag
+        auto creationTimeTag = packet->addTag<CreationTimeTag>();
+        creationTimeTag->setCreationTime(simTime());
+
+        // Add model update to packet
+        auto packetChunk = new cPacketChunk(modelUpdate);
+        packet->insertAtBack(std::shared_ptr<cPacketChunk>(packetChunk));
+
+        // Send model update to base station shard
+        socket.sendTo(packet, shardAddresses[shardIndex], destPort);
+
+        numSent++;
+        emit(sentPkSignal, packet);
+    }
 
-    // Add creation time tag
-    auto creationTimeTag = packet->addTag<CreationTimeTag>();
-    creationTimeTag->setCreationTime(simTime());
+    EV_INFO << "Sent model update to " << numShards << " base station shard(s). Round: " << pendingRound << endl;
+}
 
-    // Add model update to packet
-    auto packetChunk = new cPacketChunk(modelUpdate);
-    packet->insertAtBack(std::shared_ptr<cPacketChunk>(packetChunk));
+bool UAVFedAvgApp::assembleShard(ShardAssembly& assembly, int roundNumber, int shardIndex, int numShards,
+        uint32_t offset, const ParameterArena& weights, uint64_t checksum) {
+    if (numShards != (int)shardAddresses.size() || shardIndex < 0 || shardIndex >= numShards) {
+        EV_WARN << "Ignoring weights from shard " << shardIndex << " of " << numShards
+                << ", expected " << shardAddresses.size() << " shards" << endl;
+        return false;
+    }
+    ShardRange range = shardRange(localModel.getNumParameters(), numShards, shardIndex);
+    if (offset != range.offset || weights.size() != range.length
+            || computeChecksum(weights.data(), weights.size()) != checksum) {
+        EV_WARN << "Ignoring weights for round " << roundNumber << " from shard " << shardIndex
+                << ": slice does not match the local model" << endl;
+        return false;
+    }
 
-    // Send model update to base station
-    socket.sendTo(packet, destAddress, destPort);
+    if (assembly.roundNumber != roundNumber) {
+        assembly.roundNumber = roundNumber;
+        assembly.received.assign(numShards, false);
+        assembly.numReceived = 0;
+    }
 
-    EV_INFO << "Sent model update to base station. Round: " << currentRound << endl;
+    std::copy(weights.begin(), weights.end(), localModel.getMutableWeights().begin() + offset);
+    if (assembly.received[shardIndex])
+        return false;
+    assembly.received[shardIndex] = true;
+    assembly.numReceived++;
 
-    numSent++;
-    emit(sentPkSignal, packet);
+    // Complete once the last missing slice arrived
+    return assembly.numReceived == numShards;
 }
 
 void UAVFedAvgApp::sendSensorData() {
@@ -187,6 +356,7 @@ void UAVFedAvgApp::socketDataArrived(UdpSocket *socket, Packet *packet) {
 
     numReceived++;
     emit(rcvdPkSignal, packet);
+    observeLinkQuality(packet);
 
     // Check if it's a FedAvg message
     cPacketChunk *chunk = dynamic_cast<cPacketChunk *>(packet->peekAtFront().get());
@@ -208,13 +378,23 @@ void UAVFedAvgApp::socketDataArrived(UdpSocket *socket, Packet *packet) {
 }
 
 void UAVFedAvgApp::startTrainingRound(FedAvgInitiateTraining* initMsg) {
+    // Update local model with this shard's slice of the global weights;
+    // the round starts once every shard's slice has arrived
+    if (!assembleShard(initAssembly, initMsg->getRoundNumber(), initMsg->getShardIndex(), initMsg->getNumShards(),
+            initMsg->getWeightsOffset(), initMsg->getWeights(), initMsg->getWeightsChecksum()))
+        return;
+
     // Update current round
     currentRound = initMsg->getRoundNumber();
 
-    // Update local model with global weights
-    localModel.setWeights(initMsg->getWeights());
-
     EV_INFO << "Starting training round " << currentRound << endl;
+    roundStartTime = simTime();
+
+    // An upload still waiting for its link window belongs to the old round
+    if (uploadTimer->isScheduled()) {
+        EV_WARN << "Dropping deferred upload for the previous round" << endl;
+        cancelEvent(uploadTimer);
+    }
 
     // Schedule local training
     if (!trainingInProgress) {
@@ -223,8 +403,19 @@ void UAVFedAvgApp::startTrainingRound(FedAvgInitiateTraining* initMsg) {
 }
 
 void UAVFedAvgApp::processGlobalModel(FedAvgGlobalModel* globalModel) {
-    // Update local model with new global weights
-    localModel.setWeights(globalModel->getWeights());
+    // The base station has aggregated this round, so an upload for it
+    // still waiting for its link window would only be dropped there
+    if (uploadTimer->isScheduled() && globalModel->getRoundNumber() >= pendingRound) {
+        EV_WARN << "Dropping deferred upload for round " << pendingRound << ", already aggregated" << endl;
+        cancelEvent(uploadTimer);
+    }
+
+    // Update local model with this shard's slice of the new global weights;
+    // the round is complete once every shard's slice has arrived
+    if (!assembleShard(globalAssembly, globalModel->getRoundNumber(), globalModel->getShardIndex(),
+            globalModel->getNumShards(), globalModel->getWeightsOffset(), globalModel->getWeights(),
+            globalModel->getWeightsChecksum()))
+        return;
 
     EV_INFO << "Updated local model with global weights. Round: " <<
         globalModel->getRoundNumber() <<
@@ -238,7 +429,7 @@ void UAVFedAvgApp::processGlobalModel(FedAvgGlobalModel* globalModel) {
     currentRound = globalModel->getRoundNumber() + 1;
 
     // If we have enough data, schedule next training round
-    if (localData.size() >= dataCollectionSize && !trainingInProgress) {
+    if (localLabels.size() >= dataCollectionSize && !trainingInProgress) {
         scheduleAt(simTime() + trainingInterval, trainingTimer);
     }
 }
@@ -268,6 +459,7 @@ void UAVFedAvgApp::handleStartOperation(LifecycleOperation *operation) {
 void UAVFedAvgApp::handleStopOperation(LifecycleOperation *operation) {
     cancelEvent(sensorDataTimer);
     cancelEvent(trainingTimer);
+    cancelEvent(uploadTimer);
     socket.close();
     delayActiveOperationFinish(par("stopOperationTimeout"));
 }
@@ -275,6 +467,7 @@ void UAVFedAvgApp::handleStopOperation(LifecycleOperation *operation) {
 void UAVFedAvgApp::handleCrashOperation(LifecycleOperation *operation) {
     cancelEvent(sensorDataTimer);
     cancelEvent(trainingTimer);
+    cancelEvent(uploadTimer);
     socket.destroy();
 }
 
@@ -282,4 +475,5 @@ void UAVFedAvgApp::finish() {
     ApplicationBase::finish();
     EV_INFO << "UAV FedAvg Application finished. Sent: " << numSent << " packets, Received: " << numReceived << " packets." << endl;
     EV_INFO << "Completed " << numTrainingRounds << " training rounds." << endl;
+    EV_INFO << "Deferred " << numDeferredUploads << " uploads, observed " << numLinkFailures << " link failures." << endl;
 }
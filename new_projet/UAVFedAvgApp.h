@@ -6,23 +6,28 @@
 #include "inet/transportlayer/contract/udp/UdpSocket.h"
 #include "inet/common/lifecycle/LifecycleOperation.h"
 #include "inet/common/packet/Packet.h"
+#include "inet/mobility/contract/IMobility.h"
 #include "FedAvgModel.h"
+#include "FedAvgEvaluator.h"
+#include "FedAvgUploadScheduler.h"
 #include "FedAvgMessages_m.h"
 
 using namespace omnetpp;
 using namespace inet;
 
-class UAVFedAvgApp : public ApplicationBase, public UdpSocket::ICallback {
+class UAVFedAvgApp : public ApplicationBase, public UdpSocket::ICallback, public cListener {
   protected:
     // Configuration
     int localPort = -1;
     int destPort = -1;
     L3Address destAddress;
+    std::vector<L3Address> shardAddresses;  // Base station shards, in shard index order
 
     // Socket and timers
     UdpSocket socket;
     cMessage *sensorDataTimer = nullptr;
     cMessage *trainingTimer = nullptr;
+    cMessage *uploadTimer = nullptr;
     simtime_t sensorInterval;
     simtime_t trainingInterval;
 
@@ -30,19 +35,48 @@ class UAVFedAvgApp : public ApplicationBase, public UdpSocket::ICallback {
     FedAvgModel localModel;
     int currentRound = 0;
     int dataCollectionSize = 100; // Number of samples to collect before training
+    double learningRate = 0.1;
+    int localEpochs = 1;
+    FedAvgTeacher<FedAvgScalar> teacher; // Labels the sensor samples
     bool trainingInProgress = false;
 
-    // Simulated sensor data storage
-    std::vector<std::vector<double>> localData;
+    // Slices of a model being received from the base station shards
+    struct ShardAssembly {
+        int roundNumber = -1;
+        std::vector<bool> received;
+        int numReceived = 0;
+    };
+    ShardAssembly initAssembly;
+    ShardAssembly globalAssembly;
+
+    // Upload scheduling
+    bool uploadScheduling = true;
+    simtime_t uploadDeadline;          // Latest upload time, relative to the round start
+    simtime_t uploadPredictionStep;
+    simtime_t roundStartTime;
+    ParameterArena pendingWeights;     // Trained weights waiting for their upload window
+    int pendingRound = -1;             // Round the pending weights were trained for
+    int pendingNumSamples = 0;
+    FedAvgUploadScheduler uploadScheduler;
+    cModule *host = nullptr;
+    IMobility *mobility = nullptr;
+    IMobility *baseStationMobility = nullptr;
+
+    // Simulated sensor data storage: one row of features per sample
+    std::vector<FedAvgScalar> localFeatures;
+    std::vector<int> localLabels;
 
     // Statistics
     int numSent = 0;
     int numReceived = 0;
     int numTrainingRounds = 0;
+    int numDeferredUploads = 0;
+    int numLinkFailures = 0;
     static simsignal_t sentPkSignal;
     static simsignal_t rcvdPkSignal;
     static simsignal_t roundCompletedSignal;
     static simsignal_t trainingLossSignal;
+    static simsignal_t uploadDelaySignal;
 
   protected:
     virtual void initialize(int stage) override;
@@ -53,15 +87,23 @@ class UAVFedAvgApp : public ApplicationBase, public UdpSocket::ICallback {
     virtual void sendSensorData();
     virtual void collectSensorData();
     virtual void performLocalTraining();
+    virtual void scheduleModelUpload();
     virtual void sendModelUpdate();
+    virtual bool getKinematicState(IMobility *mobility, KinematicState& state) const;
+    virtual void observeLinkQuality(Packet *packet);
     virtual void processGlobalModel(FedAvgGlobalModel* globalModel);
     virtual void startTrainingRound(FedAvgInitiateTraining* initMsg);
+    virtual bool assembleShard(ShardAssembly& assembly, int roundNumber, int shardIndex, int numShards,
+            uint32_t offset, const ParameterArena& weights, uint64_t checksum);
 
     // Socket methods
     virtual void socketDataArrived(UdpSocket *socket, Packet *packet) override;
     virtual void socketErrorArrived(UdpSocket *socket, Indication *indication) override;
     virtual void socketClosed(UdpSocket *socket) override;
 
+    // Link failures reported by the MAC
+    virtual void receiveSignal(cComponent *source, simsignal_t signalID, cObject *obj, cObject *details) override;
+
     // LifecycleOperation
     virtual void handleStartOperation(LifecycleOperation *operation) override;
     virtual void handleStopOperation(LifecycleOperation *operation) override;